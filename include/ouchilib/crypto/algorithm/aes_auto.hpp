@@ -0,0 +1,96 @@
+﻿#pragma once
+#include <variant>
+#include <stdexcept>
+#include "aes_table.hpp"
+#include "aes_bitsliced.hpp"
+#include "aes_ni.hpp"
+#include "aes_vaes.hpp"
+#include "../cpu_features.hpp"
+#include "../cipher_mode.hpp"
+
+namespace ouchi::crypto {
+
+enum class aes_backend {
+    software,  // aes_bitsliced. constant time
+    ni,        // aes_ni
+    vaes,      // aes_vaes
+    table,     // aes_table. t-tables : faster than software, but the table lookups depend on the key and data
+};
+
+/// <summary>
+/// aes running on the fastest implementation the cpu supports, chosen at run time.
+/// without aes-ni the default is the constant time bitsliced software. aes_table is
+/// faster there but leaks through cache timing, so it is used only when asked for (aes_backend::table).
+/// every backend gives the same output.
+/// </summary>
+template<size_t KeyLength>
+struct aes_auto {
+    static constexpr size_t block_size = aes_bitsliced<KeyLength>::block_size;
+    using block_t = memory_view<block_size>;
+    using key_t = memory_entity<KeyLength>;
+    using key_view = memory_view<KeyLength>;
+
+    aes_auto(key_view key)
+        : aes_auto(key, best_backend())
+    {}
+    // throws std::invalid_argument if the cpu does not support backend
+    aes_auto(key_view key, aes_backend backend)
+    {
+        if (!supported(backend)) throw std::invalid_argument("aes_auto: backend is not supported by this cpu");
+        switch (backend) {
+        case aes_backend::software: impl_.template emplace<aes_bitsliced<KeyLength>>(key); break;
+        case aes_backend::ni: impl_.template emplace<aes_ni<KeyLength>>(key); break;
+        case aes_backend::vaes: impl_.template emplace<aes_vaes<KeyLength>>(key); break;
+        case aes_backend::table: impl_.template emplace<aes_table<KeyLength>>(key); break;
+        }
+    }
+
+    static bool supported(aes_backend backend) noexcept
+    {
+        switch (backend) {
+        case aes_backend::ni: return cpu_features::get().aes;
+        case aes_backend::vaes: return aes_vaes<KeyLength>::supported();
+        default: return true;
+        }
+    }
+    static aes_backend best_backend() noexcept
+    {
+        if (supported(aes_backend::vaes)) return aes_backend::vaes;
+        if (supported(aes_backend::ni)) return aes_backend::ni;
+        return aes_backend::software;
+    }
+    aes_backend backend() const noexcept
+    {
+        return static_cast<aes_backend>(impl_.index());
+    }
+
+    void set_key(key_view key) noexcept
+    {
+        std::visit([key](auto& a) { a.set_key(key); }, impl_);
+    }
+    void encrypt(block_t src, void* dest) const noexcept
+    {
+        std::visit([src, dest](auto& a) { a.encrypt(src, dest); }, impl_);
+    }
+    void decrypt(block_t src, void* dest) const noexcept
+    {
+        std::visit([src, dest](auto& a) { a.decrypt(src, dest); }, impl_);
+    }
+    // one dispatch per call, so modes should pass as many blocks as they can
+    void encrypt_blocks(const void* src, void* dest, size_t nblocks) const noexcept
+    {
+        std::visit([=](auto& a) { detail::encrypt_blocks(a, src, dest, nblocks); }, impl_);
+    }
+    void decrypt_blocks(const void* src, void* dest, size_t nblocks) const noexcept
+    {
+        std::visit([=](auto& a) { detail::decrypt_blocks(a, src, dest, nblocks); }, impl_);
+    }
+private:
+    // in the order of aes_backend
+    std::variant<aes_bitsliced<KeyLength>, aes_ni<KeyLength>, aes_vaes<KeyLength>, aes_table<KeyLength>> impl_;
+};
+
+using aes128_auto = aes_auto<16>;
+using aes192_auto = aes_auto<24>;
+using aes256_auto = aes_auto<32>;
+}
@@ -0,0 +1,413 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include "../common.hpp"
+
+namespace ouchi::crypto {
+
+namespace detail {
+
+// 4 blocks held as 8 words. bit b of every byte of the blocks lives in q[b],
+// so sub_bytes is a boolean circuit over the words and no memory access depends on the data.
+namespace bitslice {
+
+inline void sbox(std::uint64_t* q) noexcept
+{
+    // boyar and peralta's circuit for the aes s-box
+    std::uint64_t x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4], x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // top linear transformation
+    auto y14 = x3 ^ x5;
+    auto y13 = x0 ^ x6;
+    auto y9 = x0 ^ x3;
+    auto y8 = x0 ^ x5;
+    auto t0 = x1 ^ x2;
+    auto y1 = t0 ^ x7;
+    auto y4 = y1 ^ x3;
+    auto y12 = y13 ^ y14;
+    auto y2 = y1 ^ x0;
+    auto y5 = y1 ^ x6;
+    auto y3 = y5 ^ y8;
+    auto t1 = x4 ^ y12;
+    auto y15 = t1 ^ x5;
+    auto y20 = t1 ^ x1;
+    auto y6 = y15 ^ x7;
+    auto y10 = y15 ^ t0;
+    auto y11 = y20 ^ y9;
+    auto y7 = x7 ^ y11;
+    auto y17 = y10 ^ y11;
+    auto y19 = y10 ^ y8;
+    auto y16 = t0 ^ y11;
+    auto y21 = y13 ^ y16;
+    auto y18 = x0 ^ y16;
+
+    // non linear section
+    auto t2 = y12 & y15;
+    auto t3 = y3 & y6;
+    auto t4 = t3 ^ t2;
+    auto t5 = y4 & x7;
+    auto t6 = t5 ^ t2;
+    auto t7 = y13 & y16;
+    auto t8 = y5 & y1;
+    auto t9 = t8 ^ t7;
+    auto t10 = y2 & y7;
+    auto t11 = t10 ^ t7;
+    auto t12 = y9 & y11;
+    auto t13 = y14 & y17;
+    auto t14 = t13 ^ t12;
+    auto t15 = y8 & y10;
+    auto t16 = t15 ^ t12;
+    auto t17 = t4 ^ t14;
+    auto t18 = t6 ^ t16;
+    auto t19 = t9 ^ t14;
+    auto t20 = t11 ^ t16;
+    auto t21 = t17 ^ y20;
+    auto t22 = t18 ^ y19;
+    auto t23 = t19 ^ y21;
+    auto t24 = t20 ^ y18;
+
+    auto t25 = t21 ^ t22;
+    auto t26 = t21 & t23;
+    auto t27 = t24 ^ t26;
+    auto t28 = t25 & t27;
+    auto t29 = t28 ^ t22;
+    auto t30 = t23 ^ t24;
+    auto t31 = t22 ^ t26;
+    auto t32 = t31 & t30;
+    auto t33 = t32 ^ t24;
+    auto t34 = t23 ^ t33;
+    auto t35 = t27 ^ t33;
+    auto t36 = t24 & t35;
+    auto t37 = t36 ^ t34;
+    auto t38 = t27 ^ t36;
+    auto t39 = t29 & t38;
+    auto t40 = t25 ^ t39;
+
+    auto t41 = t40 ^ t37;
+    auto t42 = t29 ^ t33;
+    auto t43 = t29 ^ t40;
+    auto t44 = t33 ^ t37;
+    auto t45 = t42 ^ t41;
+    auto z0 = t44 & y15;
+    auto z1 = t37 & y6;
+    auto z2 = t33 & x7;
+    auto z3 = t43 & y16;
+    auto z4 = t40 & y1;
+    auto z5 = t29 & y7;
+    auto z6 = t42 & y11;
+    auto z7 = t45 & y17;
+    auto z8 = t41 & y10;
+    auto z9 = t44 & y12;
+    auto z10 = t37 & y3;
+    auto z11 = t33 & y4;
+    auto z12 = t43 & y13;
+    auto z13 = t40 & y5;
+    auto z14 = t29 & y2;
+    auto z15 = t42 & y9;
+    auto z16 = t45 & y14;
+    auto z17 = t41 & y8;
+
+    // bottom linear transformation
+    auto t46 = z15 ^ z16;
+    auto t47 = z10 ^ z11;
+    auto t48 = z5 ^ z13;
+    auto t49 = z9 ^ z10;
+    auto t50 = z2 ^ z12;
+    auto t51 = z2 ^ z5;
+    auto t52 = z7 ^ z8;
+    auto t53 = z0 ^ z3;
+    auto t54 = z6 ^ z7;
+    auto t55 = z16 ^ z17;
+    auto t56 = z12 ^ t48;
+    auto t57 = t50 ^ t53;
+    auto t58 = z4 ^ t46;
+    auto t59 = z3 ^ t54;
+    auto t60 = t46 ^ t57;
+    auto t61 = z14 ^ t57;
+    auto t62 = t52 ^ t58;
+    auto t63 = t49 ^ t58;
+    auto t64 = z4 ^ t59;
+    auto t65 = t61 ^ t62;
+    auto t66 = z1 ^ t63;
+    auto s0 = t59 ^ t63;
+    auto s6 = t56 ^ ~t62;
+    auto s7 = t48 ^ ~t60;
+    auto t67 = t64 ^ t65;
+    auto s3 = t53 ^ t66;
+    auto s4 = t51 ^ t66;
+    auto s5 = t47 ^ t65;
+    auto s1 = t64 ^ ~s3;
+    auto s2 = t55 ^ ~t67;
+
+    q[7] = s0; q[6] = s1; q[5] = s2; q[4] = s3;
+    q[3] = s4; q[2] = s5; q[1] = s6; q[0] = s7;
+}
+
+// inverse of the affine map of the s-box
+inline void inv_affine(std::uint64_t* q) noexcept
+{
+    std::uint64_t q0 = ~q[0], q1 = ~q[1], q2 = q[2], q3 = q[3], q4 = q[4], q5 = ~q[5], q6 = ~q[6], q7 = q[7];
+    q[7] = q1 ^ q4 ^ q6;
+    q[6] = q0 ^ q3 ^ q5;
+    q[5] = q7 ^ q2 ^ q4;
+    q[4] = q6 ^ q1 ^ q3;
+    q[3] = q5 ^ q0 ^ q2;
+    q[2] = q4 ^ q7 ^ q1;
+    q[1] = q3 ^ q6 ^ q0;
+    q[0] = q2 ^ q5 ^ q7;
+}
+// the inverse s-box is the s-box between two inverse affine maps
+inline void inv_sbox(std::uint64_t* q) noexcept
+{
+    inv_affine(q);
+    sbox(q);
+    inv_affine(q);
+}
+
+// transposes between 4 interleaved blocks and bit planes. its own inverse.
+inline void ortho(std::uint64_t* q) noexcept
+{
+    auto swap = [](std::uint64_t& x, std::uint64_t& y, std::uint64_t cl, std::uint64_t ch, unsigned s) {
+        auto a = x, b = y;
+        x = (a & cl) | ((b & cl) << s);
+        y = ((a & ch) >> s) | (b & ch);
+    };
+    for (int i = 0; i < 8; i += 2) swap(q[i], q[i + 1], 0x5555555555555555, 0xAAAAAAAAAAAAAAAA, 1);
+    for (int i : { 0, 1, 4, 5 }) swap(q[i], q[i + 2], 0x3333333333333333, 0xCCCCCCCCCCCCCCCC, 2);
+    for (int i = 0; i < 4; ++i) swap(q[i], q[i + 4], 0x0F0F0F0F0F0F0F0F, 0xF0F0F0F0F0F0F0F0, 4);
+}
+
+// spreads the 4 little endian words of a block over two words, 16 bits per byte lane
+inline void interleave_in(std::uint64_t& q0, std::uint64_t& q1, const std::uint32_t* w) noexcept
+{
+    std::uint64_t x[4];
+    for (int i = 0; i < 4; ++i) {
+        x[i] = w[i];
+        x[i] |= x[i] << 16;
+        x[i] &= 0x0000FFFF0000FFFF;
+        x[i] |= x[i] << 8;
+        x[i] &= 0x00FF00FF00FF00FF;
+    }
+    q0 = x[0] | (x[2] << 8);
+    q1 = x[1] | (x[3] << 8);
+}
+inline void interleave_out(std::uint32_t* w, std::uint64_t q0, std::uint64_t q1) noexcept
+{
+    std::uint64_t x[4] = {
+        q0 & 0x00FF00FF00FF00FF, q1 & 0x00FF00FF00FF00FF,
+        (q0 >> 8) & 0x00FF00FF00FF00FF, (q1 >> 8) & 0x00FF00FF00FF00FF };
+    for (int i = 0; i < 4; ++i) {
+        x[i] |= x[i] >> 8;
+        x[i] &= 0x0000FFFF0000FFFF;
+        w[i] = (std::uint32_t)x[i] | (std::uint32_t)(x[i] >> 16);
+    }
+}
+
+inline void add_round_key(std::uint64_t* q, const std::uint64_t* sk) noexcept
+{
+    for (int i = 0; i < 8; ++i) q[i] ^= sk[i];
+}
+inline void shift_rows(std::uint64_t* q) noexcept
+{
+    for (int i = 0; i < 8; ++i) {
+        auto x = q[i];
+        q[i] = (x & 0x000000000000FFFF)
+            | ((x & 0x00000000FFF00000) >> 4)
+            | ((x & 0x00000000000F0000) << 12)
+            | ((x & 0x0000FF0000000000) >> 8)
+            | ((x & 0x000000FF00000000) << 8)
+            | ((x & 0xF000000000000000) >> 12)
+            | ((x & 0x0FFF000000000000) << 4);
+    }
+}
+inline void inv_shift_rows(std::uint64_t* q) noexcept
+{
+    for (int i = 0; i < 8; ++i) {
+        auto x = q[i];
+        q[i] = (x & 0x000000000000FFFF)
+            | ((x & 0x000000000FFF0000) << 4)
+            | ((x & 0x00000000F0000000) >> 12)
+            | ((x & 0x000000FF00000000) << 8)
+            | ((x & 0x0000FF0000000000) >> 8)
+            | ((x & 0x000F000000000000) << 12)
+            | ((x & 0xFFF0000000000000) >> 4);
+    }
+}
+// rows of a column are 16 bits apart
+inline std::uint64_t rotr16(std::uint64_t x) noexcept { return (x >> 16) | (x << 48); }
+inline std::uint64_t rotr32(std::uint64_t x) noexcept { return (x >> 32) | (x << 32); }
+
+// b = 2(a ^ next row) ^ next row ^ rotr32(a ^ next row), the multiplication by 2 spelled out per bit plane
+inline void mix_columns(std::uint64_t* q) noexcept
+{
+    std::uint64_t a[8], r[8];
+    for (int i = 0; i < 8; ++i) a[i] = q[i], r[i] = rotr16(q[i]);
+    q[0] = a[7] ^ r[7] ^ r[0] ^ rotr32(a[0] ^ r[0]);
+    q[1] = a[0] ^ r[0] ^ a[7] ^ r[7] ^ r[1] ^ rotr32(a[1] ^ r[1]);
+    q[2] = a[1] ^ r[1] ^ r[2] ^ rotr32(a[2] ^ r[2]);
+    q[3] = a[2] ^ r[2] ^ a[7] ^ r[7] ^ r[3] ^ rotr32(a[3] ^ r[3]);
+    q[4] = a[3] ^ r[3] ^ a[7] ^ r[7] ^ r[4] ^ rotr32(a[4] ^ r[4]);
+    q[5] = a[4] ^ r[4] ^ r[5] ^ rotr32(a[5] ^ r[5]);
+    q[6] = a[5] ^ r[5] ^ r[6] ^ rotr32(a[6] ^ r[6]);
+    q[7] = a[6] ^ r[6] ^ r[7] ^ rotr32(a[7] ^ r[7]);
+}
+// inv_mix_columns(a) = mix_columns(a ^ 4(a ^ rotr32(a))), since {0b,0d,09,0e} = {03,01,01,02} * {05,00,04,00}
+inline void inv_mix_columns(std::uint64_t* q) noexcept
+{
+    std::uint64_t t[8];
+    for (int i = 0; i < 8; ++i) t[i] = q[i] ^ rotr32(q[i]);
+    // multiplication by 4 : two doublings with the reduction by x^8 = x^4 + x^3 + x + 1
+    for (int k = 0; k < 2; ++k) {
+        auto hi = t[7];
+        for (int i = 7; i > 0; --i) t[i] = t[i - 1];
+        t[0] = hi;
+        t[1] ^= hi;
+        t[3] ^= hi;
+        t[4] ^= hi;
+    }
+    for (int i = 0; i < 8; ++i) q[i] ^= t[i];
+    mix_columns(q);
+}
+
+} // namespace bitslice
+} // namespace detail
+
+/// <summary>
+/// constant time aes. 4 blocks are bitsliced into 64 bit words, so no table or branch depends on the key or the data.
+/// encrypt_blocks processes 4 blocks at the cost of about one, which suits ecb and ctr.
+/// </summary>
+template<size_t KeyLength>
+struct aes_bitsliced {
+    static_assert(KeyLength == 16 || KeyLength == 24 || KeyLength == 32);
+    static constexpr size_t nb = 4;
+    static constexpr size_t nr = KeyLength / 4 + 6;
+    static constexpr size_t block_size = 4 * nb;
+    using block_t = memory_view<block_size>;
+    using key_t = memory_entity<KeyLength>;
+    using key_view = memory_view<KeyLength>;
+
+    aes_bitsliced(key_view key)
+    {
+        set_key(key);
+    }
+    aes_bitsliced() = default;
+    ~aes_bitsliced()
+    {
+        secure_memset(sk_, 0);
+    }
+
+    void set_key(key_view key) noexcept
+    {
+        using namespace detail::bitslice;
+        constexpr std::uint32_t rcon[10] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+        constexpr auto nk = KeyLength / 4;
+        // the usual key expansion on little endian words
+        std::uint32_t w[nb * (nr + 1)];
+        for (size_t i = 0; i < nk; ++i) w[i] = load32(key.data + i * 4);
+        for (size_t i = nk; i < nb * (nr + 1); ++i) {
+            auto temp = w[i - 1];
+            if (i % nk == 0)
+                temp = sub_word((temp >> 8) | (temp << 24)) ^ rcon[i / nk - 1];
+            else if (nk > 6 && i % nk == 4)
+                temp = sub_word(temp);
+            w[i] = w[i - nk] ^ temp;
+        }
+        // every round key as if it were 4 equal blocks
+        for (size_t r = 0; r <= nr; ++r) {
+            auto* q = sk_ + r * 8;
+            interleave_in(q[0], q[4], w + r * 4);
+            q[1] = q[2] = q[3] = q[0];
+            q[5] = q[6] = q[7] = q[4];
+            ortho(q);
+        }
+        secure_memset(w, 0);
+    }
+    void encrypt(block_t src, void* dest) const noexcept
+    {
+        encrypt_blocks(src.data, dest, 1);
+    }
+    void decrypt(block_t src, void* dest) const noexcept
+    {
+        decrypt_blocks(src.data, dest, 1);
+    }
+    // src and dest may be the same
+    void encrypt_blocks(const void* src, void* dest, size_t nblocks) const noexcept
+    {
+        using namespace detail::bitslice;
+        process(src, dest, nblocks, [this](std::uint64_t* q) {
+            add_round_key(q, sk_);
+            for (size_t r = 1; r < nr; ++r) {
+                sbox(q);
+                shift_rows(q);
+                mix_columns(q);
+                add_round_key(q, sk_ + r * 8);
+            }
+            sbox(q);
+            shift_rows(q);
+            add_round_key(q, sk_ + nr * 8);
+        });
+    }
+    void decrypt_blocks(const void* src, void* dest, size_t nblocks) const noexcept
+    {
+        using namespace detail::bitslice;
+        process(src, dest, nblocks, [this](std::uint64_t* q) {
+            add_round_key(q, sk_ + nr * 8);
+            for (size_t r = nr - 1; r > 0; --r) {
+                inv_shift_rows(q);
+                inv_sbox(q);
+                add_round_key(q, sk_ + r * 8);
+                inv_mix_columns(q);
+            }
+            inv_shift_rows(q);
+            inv_sbox(q);
+            add_round_key(q, sk_);
+        });
+    }
+private:
+    static std::uint32_t load32(const std::uint8_t* p) noexcept
+    {
+        return (std::uint32_t)p[0] | ((std::uint32_t)p[1] << 8) | ((std::uint32_t)p[2] << 16) | ((std::uint32_t)p[3] << 24);
+    }
+    static void store32(std::uint8_t* p, std::uint32_t x) noexcept
+    {
+        p[0] = (std::uint8_t)x, p[1] = (std::uint8_t)(x >> 8), p[2] = (std::uint8_t)(x >> 16), p[3] = (std::uint8_t)(x >> 24);
+    }
+    // the s-box on each byte of a word, through the same circuit
+    static std::uint32_t sub_word(std::uint32_t x) noexcept
+    {
+        using namespace detail::bitslice;
+        std::uint64_t q[8] = { x };
+        ortho(q);
+        sbox(q);
+        ortho(q);
+        return (std::uint32_t)q[0];
+    }
+    // runs rounds on groups of 4 blocks. a short group is padded with zero blocks
+    template<class Rounds>
+    static void process(const void* src, void* dest, size_t nblocks, Rounds rounds) noexcept
+    {
+        using namespace detail::bitslice;
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        while (nblocks) {
+            auto n = nblocks < 4 ? nblocks : 4;
+            std::uint32_t w[16] = {};
+            for (size_t i = 0; i < n * 4; ++i) w[i] = load32(in + i * 4);
+            std::uint64_t q[8];
+            for (int i = 0; i < 4; ++i) interleave_in(q[i], q[i + 4], w + i * 4);
+            ortho(q);
+            rounds(q);
+            ortho(q);
+            for (int i = 0; i < 4; ++i) interleave_out(w + i * 4, q[i], q[i + 4]);
+            for (size_t i = 0; i < n * 4; ++i) store32(out + i * 4, w[i]);
+            in += n * block_size, out += n * block_size, nblocks -= n;
+        }
+    }
+
+    std::uint64_t sk_[8 * (nr + 1)];  // bitsliced round keys
+};
+
+using aes128_bitsliced = aes_bitsliced<16>;
+using aes192_bitsliced = aes_bitsliced<24>;
+using aes256_bitsliced = aes_bitsliced<32>;
+}
@@ -54,10 +54,64 @@ public:
         state = _mm_aesdeclast_si128(state, dw128[0]);
         _mm_storeu_si128(reinterpret_cast<__m128i*>(dest), state);
     }
+    /// <summary>
+    /// encrypt nblocks consecutive blocks. src and dest may be the same.
+    /// up to 8 independent blocks go through each round together so that the latency of aesenc is hidden.
+    /// </summary>
+    void encrypt_blocks(const void* src, void* dest, size_t nblocks) const noexcept
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        for (; nblocks >= 8; nblocks -= 8, in += 8 * block_size, out += 8 * block_size) encrypt_n<8>(in, out);
+        if (nblocks >= 4) {
+            encrypt_n<4>(in, out);
+            nblocks -= 4, in += 4 * block_size, out += 4 * block_size;
+        }
+        for (; nblocks; --nblocks, in += block_size, out += block_size) encrypt_n<1>(in, out);
+    }
+    void decrypt_blocks(const void* src, void* dest, size_t nblocks) const noexcept
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        for (; nblocks >= 8; nblocks -= 8, in += 8 * block_size, out += 8 * block_size) decrypt_n<8>(in, out);
+        if (nblocks >= 4) {
+            decrypt_n<4>(in, out);
+            nblocks -= 4, in += 4 * block_size, out += 4 * block_size;
+        }
+        for (; nblocks; --nblocks, in += block_size, out += block_size) decrypt_n<1>(in, out);
+    }
 private:
+    // the wide backend broadcasts the round keys
+    template<size_t> friend struct aes_vaes;
     __m128i w128[nr + 1];
     __m128i dw128[nr + 1];
     key_t key_;
+    template<size_t N>
+    void encrypt_n(const std::uint8_t* in, std::uint8_t* out) const noexcept
+    {
+        __m128i state[N];
+        for (size_t i = 0; i < N; ++i)
+            state[i] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * block_size)), w128[0]);
+        for (size_t r = 1; r < nr; ++r) {
+            auto k = w128[r];
+            for (size_t i = 0; i < N; ++i) state[i] = _mm_aesenc_si128(state[i], k);
+        }
+        for (size_t i = 0; i < N; ++i)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * block_size), _mm_aesenclast_si128(state[i], w128[nr]));
+    }
+    template<size_t N>
+    void decrypt_n(const std::uint8_t* in, std::uint8_t* out) const noexcept
+    {
+        __m128i state[N];
+        for (size_t i = 0; i < N; ++i)
+            state[i] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * block_size)), dw128[nr]);
+        for (size_t r = nr - 1; r > 0; --r) {
+            auto k = dw128[r];
+            for (size_t i = 0; i < N; ++i) state[i] = _mm_aesdec_si128(state[i], k);
+        }
+        for (size_t i = 0; i < N; ++i)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i * block_size), _mm_aesdeclast_si128(state[i], dw128[0]));
+    }
     template<size_t ...S>
     inline [[nodiscard]] __m128i enc_round(__m128i state, std::index_sequence<S...>) const noexcept
     {
@@ -0,0 +1,171 @@
+﻿#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include "aes.hpp"
+#include "../common.hpp"
+
+namespace ouchi::crypto {
+
+namespace detail {
+
+constexpr std::uint8_t gf_mul(std::uint8_t a, std::uint8_t b) noexcept
+{
+    std::uint8_t r = 0;
+    for (; b; b >>= 1) {
+        if (b & 1) r ^= a;
+        a = (std::uint8_t)((a << 1) ^ ((a & 0x80) ? 0x1b : 0));
+    }
+    return r;
+}
+
+// te[0][x] is the column of mix_columns applied to (sbox[x], 0, 0, 0), te[i] is te[0] rotated by 8i bits.
+// td is the same for inv_sbox and inv_mix_columns.
+struct aes_tables {
+    std::array<std::array<std::uint32_t, 256>, 4> te{}, td{};
+
+    constexpr aes_tables() noexcept
+    {
+        for (unsigned x = 0; x < 256; ++x) {
+            std::uint8_t s = aes<16>::sbox[x], is = aes<16>::inv_sbox[x];
+            std::uint32_t e = ((std::uint32_t)gf_mul(s, 2) << 24) | ((std::uint32_t)s << 16) | ((std::uint32_t)s << 8) | gf_mul(s, 3);
+            std::uint32_t d = ((std::uint32_t)gf_mul(is, 14) << 24) | ((std::uint32_t)gf_mul(is, 9) << 16) |
+                              ((std::uint32_t)gf_mul(is, 13) << 8) | gf_mul(is, 11);
+            for (unsigned i = 0; i < 4; ++i) {
+                te[i][x] = i ? rotr(e, 8 * i) : e;
+                td[i][x] = i ? rotr(d, 8 * i) : d;
+            }
+        }
+    }
+};
+
+inline constexpr aes_tables aes_table_values{};
+
+} // namespace detail
+
+/// <summary>
+/// aes with 32 bit lookup tables merging sub_bytes, shift_rows and mix_columns.
+/// much faster than aes, but table lookups depend on the data, so it is not constant time.
+/// prefer aes_bitsliced where cache timing matters.
+/// </summary>
+template<size_t KeyLength>
+struct aes_table {
+    static_assert(KeyLength == 16 || KeyLength == 24 || KeyLength == 32);
+    static constexpr size_t nb = 4;
+    static constexpr size_t nr = KeyLength / 4 + 6;
+    static constexpr size_t block_size = 4 * nb;
+    using block_t = memory_view<block_size>;
+    using key_t = memory_entity<KeyLength>;
+    using key_view = memory_view<KeyLength>;
+
+    aes_table(key_view key)
+    {
+        set_key(key);
+    }
+    aes_table() = default;
+    ~aes_table()
+    {
+        secure_memset(ek_, 0);
+        secure_memset(dk_, 0);
+    }
+
+    void set_key(key_view key) noexcept
+    {
+        constexpr std::uint32_t rcon[10] = {
+            0x0100'0000,0x0200'0000,0x0400'0000,0x0800'0000,0x1000'0000,
+            0x2000'0000,0x4000'0000,0x8000'0000,0x1b00'0000,0x3600'0000 };
+        constexpr auto nk = KeyLength / 4;
+        for (size_t i = 0; i < nk; ++i) ek_[i] = detail::pack<std::uint32_t>(key.data + i * 4);
+        for (size_t i = nk; i < nb * (nr + 1); ++i) {
+            auto temp = ek_[i - 1];
+            if (i % nk == 0)
+                temp = sub_word(rotword(temp)) ^ rcon[i / nk - 1];
+            else if (nk > 6 && i % nk == 4)
+                temp = sub_word(temp);
+            ek_[i] = ek_[i - nk] ^ temp;
+        }
+        // equivalent inverse cipher : round keys in reverse order, inner ones through inv_mix_columns
+        auto& td = detail::aes_table_values.td;
+        for (size_t r = 0; r <= nr; ++r) {
+            for (size_t c = 0; c < 4; ++c) {
+                auto w = ek_[(nr - r) * 4 + c];
+                if (r != 0 && r != nr) {
+                    w = td[0][aes<16>::sbox[w >> 24]] ^ td[1][aes<16>::sbox[(w >> 16) & 0xff]] ^
+                        td[2][aes<16>::sbox[(w >> 8) & 0xff]] ^ td[3][aes<16>::sbox[w & 0xff]];
+                }
+                dk_[r * 4 + c] = w;
+            }
+        }
+    }
+    void encrypt(block_t src, void* dest) const noexcept
+    {
+        auto& te = detail::aes_table_values.te;
+        auto& sbox = aes<16>::sbox;
+        const std::uint32_t* rk = ek_;
+        std::uint32_t s0 = detail::pack<std::uint32_t>(src.data) ^ rk[0];
+        std::uint32_t s1 = detail::pack<std::uint32_t>(src.data + 4) ^ rk[1];
+        std::uint32_t s2 = detail::pack<std::uint32_t>(src.data + 8) ^ rk[2];
+        std::uint32_t s3 = detail::pack<std::uint32_t>(src.data + 12) ^ rk[3];
+        for (size_t r = 1; r < nr; ++r) {
+            rk += 4;
+            auto t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xff] ^ te[2][(s2 >> 8) & 0xff] ^ te[3][s3 & 0xff] ^ rk[0];
+            auto t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xff] ^ te[2][(s3 >> 8) & 0xff] ^ te[3][s0 & 0xff] ^ rk[1];
+            auto t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xff] ^ te[2][(s0 >> 8) & 0xff] ^ te[3][s1 & 0xff] ^ rk[2];
+            auto t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xff] ^ te[2][(s1 >> 8) & 0xff] ^ te[3][s2 & 0xff] ^ rk[3];
+            s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+        }
+        rk += 4;
+        auto last = [&sbox](std::uint32_t a, std::uint32_t b, std::uint32_t c, std::uint32_t d) {
+            return ((std::uint32_t)sbox[a >> 24] << 24) | ((std::uint32_t)sbox[(b >> 16) & 0xff] << 16) |
+                   ((std::uint32_t)sbox[(c >> 8) & 0xff] << 8) | sbox[d & 0xff];
+        };
+        auto* out = static_cast<std::uint8_t*>(dest);
+        detail::unpack(last(s0, s1, s2, s3) ^ rk[0], out);
+        detail::unpack(last(s1, s2, s3, s0) ^ rk[1], out + 4);
+        detail::unpack(last(s2, s3, s0, s1) ^ rk[2], out + 8);
+        detail::unpack(last(s3, s0, s1, s2) ^ rk[3], out + 12);
+    }
+    void decrypt(block_t src, void* dest) const noexcept
+    {
+        auto& td = detail::aes_table_values.td;
+        auto& inv_sbox = aes<16>::inv_sbox;
+        const std::uint32_t* rk = dk_;
+        std::uint32_t s0 = detail::pack<std::uint32_t>(src.data) ^ rk[0];
+        std::uint32_t s1 = detail::pack<std::uint32_t>(src.data + 4) ^ rk[1];
+        std::uint32_t s2 = detail::pack<std::uint32_t>(src.data + 8) ^ rk[2];
+        std::uint32_t s3 = detail::pack<std::uint32_t>(src.data + 12) ^ rk[3];
+        for (size_t r = 1; r < nr; ++r) {
+            rk += 4;
+            auto t0 = td[0][s0 >> 24] ^ td[1][(s3 >> 16) & 0xff] ^ td[2][(s2 >> 8) & 0xff] ^ td[3][s1 & 0xff] ^ rk[0];
+            auto t1 = td[0][s1 >> 24] ^ td[1][(s0 >> 16) & 0xff] ^ td[2][(s3 >> 8) & 0xff] ^ td[3][s2 & 0xff] ^ rk[1];
+            auto t2 = td[0][s2 >> 24] ^ td[1][(s1 >> 16) & 0xff] ^ td[2][(s0 >> 8) & 0xff] ^ td[3][s3 & 0xff] ^ rk[2];
+            auto t3 = td[0][s3 >> 24] ^ td[1][(s2 >> 16) & 0xff] ^ td[2][(s1 >> 8) & 0xff] ^ td[3][s0 & 0xff] ^ rk[3];
+            s0 = t0, s1 = t1, s2 = t2, s3 = t3;
+        }
+        rk += 4;
+        auto last = [&inv_sbox](std::uint32_t a, std::uint32_t b, std::uint32_t c, std::uint32_t d) {
+            return ((std::uint32_t)inv_sbox[a >> 24] << 24) | ((std::uint32_t)inv_sbox[(b >> 16) & 0xff] << 16) |
+                   ((std::uint32_t)inv_sbox[(c >> 8) & 0xff] << 8) | inv_sbox[d & 0xff];
+        };
+        auto* out = static_cast<std::uint8_t*>(dest);
+        detail::unpack(last(s0, s3, s2, s1) ^ rk[0], out);
+        detail::unpack(last(s1, s0, s3, s2) ^ rk[1], out + 4);
+        detail::unpack(last(s2, s1, s0, s3) ^ rk[2], out + 8);
+        detail::unpack(last(s3, s2, s1, s0) ^ rk[3], out + 12);
+    }
+private:
+    static constexpr std::uint32_t sub_word(std::uint32_t w) noexcept
+    {
+        auto& sbox = aes<16>::sbox;
+        return ((std::uint32_t)sbox[w >> 24] << 24) | ((std::uint32_t)sbox[(w >> 16) & 0xff] << 16) |
+               ((std::uint32_t)sbox[(w >> 8) & 0xff] << 8) | sbox[w & 0xff];
+    }
+
+    std::uint32_t ek_[nb * (nr + 1)];  // encryption round keys
+    std::uint32_t dk_[nb * (nr + 1)];  // decryption round keys
+};
+
+using aes128_table = aes_table<16>;
+using aes192_table = aes_table<24>;
+using aes256_table = aes_table<32>;
+}
@@ -1,10 +1,16 @@
 ﻿#pragma once
+#include <algorithm>
 #include <cstring>
 #include <cstdint>
 #include <string_view>
 #include <utility>
+#include <stdexcept>
 #include "../common.hpp"
 #include "ouchilib/utl/multiitr.hpp"
+#ifdef OUCHI_CRYPTO_X86
+#   include <immintrin.h>
+#   include "../cpu_features.hpp"
+#endif
 
 namespace ouchi::crypto {
 
@@ -115,8 +121,65 @@ inline constexpr std::uint64_t initial_hash_value<std::uint64_t>[8] = {
 
 inline constexpr int v[] = { 1, 2, 3, 4 };
 
+#ifdef OUCHI_CRYPTO_X86
+// rounds 4G..4G+3 on the sha extensions. m holds the message schedule in a ring of 4 vectors.
+// sha256rnds2 does 2 rounds, sha256msg1/2 compute the schedule 4 words at a time.
+template<int G>
+OUCHI_TARGET("sha,sse4.1,ssse3") OUCHI_FORCEINLINE
+void sha256_ni_rounds(__m128i& s0, __m128i& s1, __m128i (&m)[4], const std::uint8_t* block, __m128i bswap) noexcept
+{
+    if constexpr (G < 4) m[G] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * G)), bswap);
+    auto msg = _mm_add_epi32(m[G % 4], _mm_loadu_si128(reinterpret_cast<const __m128i*>(sha_constants<std::uint32_t> + 4 * G)));
+    s1 = _mm_sha256rnds2_epu32(s1, s0, msg);
+    if constexpr (G >= 3 && G < 15) {
+        auto& next = m[(G + 1) % 4];
+        next = _mm_sha256msg2_epu32(_mm_add_epi32(next, _mm_alignr_epi8(m[G % 4], m[(G + 3) % 4], 4)), m[G % 4]);
+    }
+    s0 = _mm_sha256rnds2_epu32(s0, s1, _mm_shuffle_epi32(msg, 0x0e));
+    if constexpr (G >= 1 && G < 13) m[(G + 3) % 4] = _mm_sha256msg1_epu32(m[(G + 3) % 4], m[G % 4]);
+}
+
+template<int... G>
+OUCHI_TARGET("sha,sse4.1,ssse3") OUCHI_FORCEINLINE
+void sha256_ni_block(__m128i& s0, __m128i& s1, const std::uint8_t* block, __m128i bswap,
+                     std::integer_sequence<int, G...>) noexcept
+{
+    __m128i m[4];
+    (sha256_ni_rounds<G>(s0, s1, m, block, bswap), ...);
+}
+
+// sha-256 on the sha extensions. state is a, b, .., h.
+OUCHI_TARGET("sha,sse4.1,ssse3")
+inline void sha256_ni_compress(std::uint32_t* state, const std::uint8_t* blocks, size_t nblocks) noexcept
+{
+    const auto bswap = _mm_set_epi64x(0x0c0d0e0f08090a0b, 0x0405060700010203);
+    // the instructions take the state as abef and cdgh
+    auto tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xb1);  // cdab
+    auto s1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1b);  // efgh
+    auto s0 = _mm_alignr_epi8(tmp, s1, 8);    // abef
+    s1 = _mm_blend_epi16(s1, tmp, 0xf0);      // cdgh
+
+    for (; nblocks; --nblocks, blocks += 64) {
+        auto abef = s0, cdgh = s1;
+        sha256_ni_block(s0, s1, blocks, bswap, std::make_integer_sequence<int, 16>{});
+        s0 = _mm_add_epi32(s0, abef);
+        s1 = _mm_add_epi32(s1, cdgh);
+    }
+
+    tmp = _mm_shuffle_epi32(s0, 0x1b);        // feba
+    s1 = _mm_shuffle_epi32(s1, 0xb1);         // dchg
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(tmp, s1, 0xf0));     // dcba
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(s1, tmp, 8));    // hgfe
+}
+#endif
+
 } // namespace detail
 
+enum class sha_backend {
+    scalar,
+    ni,      // sha extensions. sha-256 on x86 only
+};
+
 template<int Len>
 class sha {
     static constexpr unsigned last_block_m_length = (1024 - 128) / 8 / (Len <= 256 ? 2 : 1);
@@ -125,32 +188,66 @@ class sha {
     elm_type h_[8];
     size_t length_;
     std::uint8_t buffer_[block_length];
+    sha_backend backend_;
 public:
     sha()
+        : sha(best_backend())
+    {}
+    // throws std::invalid_argument if the cpu does not support backend
+    explicit sha(sha_backend backend)
         : h_{}
         , length_{0}
         , buffer_{}
+        , backend_{ backend }
     {
+        if (!supported(backend)) throw std::invalid_argument("sha: backend is not supported");
         for (auto [h, ih] : ouchi::multiitr{ h_, detail::initial_hash_value<elm_type> }) {
             h = ih;
         }
     }
+    static bool supported(sha_backend backend) noexcept
+    {
+        if (backend != sha_backend::ni) return true;
+#ifdef OUCHI_CRYPTO_X86
+        auto& f = cpu_features::get();
+        return Len == 256 && f.sha && f.sse41 && f.ssse3;
+#else
+        return false;
+#endif
+    }
+    static sha_backend best_backend() noexcept
+    {
+        return supported(sha_backend::ni) ? sha_backend::ni : sha_backend::scalar;
+    }
+    sha_backend backend() const noexcept
+    {
+        return backend_;
+    }
     void update(std::string_view message) noexcept
     {
         update(message.data(), message.size());
     }
+    // whole blocks are compressed straight from message. only the fragments around them are buffered.
     void update(const void* message, size_t size) noexcept
     {
-        constexpr size_t lidx = block_length - 1;
+        if (!size) return;
         auto* ptr = reinterpret_cast<const std::uint8_t*>(message);
-        while (size) {
-            buffer_[length_ & lidx] = *ptr++;
-            --size;
-            ++length_;
-            if ((length_ & lidx) == 0) {
-                process_block(buffer_);
-            }
+        const size_t used = length_ & (block_length - 1);
+        length_ += size;
+        if (used) {
+            const auto fill = (std::min)(size, block_length - used);
+            std::memcpy(buffer_ + used, ptr, fill);
+            if (used + fill < block_length) return;
+            process_block(buffer_);
+            ptr += fill;
+            size -= fill;
+        }
+        if (const auto n = size / block_length) {
+            process_blocks(ptr, n);
+            ptr += n * block_length;
+            size -= n * block_length;
         }
+        if (size) std::memcpy(buffer_, ptr, size);
     }
     memory_entity<Len/8> finalize() noexcept
     {
@@ -167,7 +264,7 @@ public:
             }
         }
         if constexpr (sizeof(elm_type) == sizeof(std::uint64_t)) {
-            detail::unpack(0, buffer_ + last_block_m_length);
+            detail::unpack(std::uint64_t{ 0 }, buffer_ + last_block_m_length);
             detail::unpack(length_ * 8, buffer_ + last_block_m_length + sizeof(elm_type));
         } else {
             detail::unpack(length_ * 8, buffer_ + last_block_m_length);
@@ -182,41 +279,51 @@ public:
     }
 
 private:
-    void process_block(void* block) noexcept
+    void process_block(const void* block) noexcept
     {
-        constexpr size_t w_size = Len > 256 ? 80 : 64;
-        elm_type w[w_size] = {};
-        auto* ptr = reinterpret_cast<const std::uint8_t*>(block);
-        for (auto i = 0u; i < 16; ++i) {
-            w[i] = detail::pack<elm_type>(ptr + (i * sizeof(elm_type)));
-        }
-        for (auto i = 16u; i < w_size; ++i) {
-            w[i] = detail::sha_f3(w[i - 2]) + w[i - 7] + detail::sha_f2(w[i - 15]) + w[i - 16];
+        process_blocks(block, 1);
+    }
+    void process_blocks(const void* blocks, size_t count) noexcept
+    {
+        auto* ptr = reinterpret_cast<const std::uint8_t*>(blocks);
+#ifdef OUCHI_CRYPTO_X86
+        if constexpr (Len == 256) {
+            if (backend_ == sha_backend::ni) return detail::sha256_ni_compress(h_, ptr, count);
         }
-        elm_type a{ h_[0] }, b{ h_[1] }, c{ h_[2] }, d{ h_[3] },
-            e{ h_[4] }, f{ h_[5] }, g{ h_[6] }, h{ h_[7] };
-        for (auto i = 0u; i < w_size; ++i) {
-            auto t1 = h + detail::sha_f1(e) + detail::ch(e, f, g) +
-                detail::sha_constants<elm_type>[i] + w[i];
-            auto t2 = detail::sha_f0(a) + detail::maj(a, b, c);
-            h = g;
-            g = f;
-            f = e;
-            e = d + t1;
-            d = c;
-            c = b;
-            b = a;
-            a = t1 + t2;
+#endif
+        constexpr size_t w_size = Len > 256 ? 80 : 64;
+        elm_type w[w_size];
+        for (; count; --count, ptr += block_length) {
+            for (auto i = 0u; i < 16; ++i) {
+                w[i] = detail::pack<elm_type>(ptr + (i * sizeof(elm_type)));
+            }
+            for (auto i = 16u; i < w_size; ++i) {
+                w[i] = detail::sha_f3(w[i - 2]) + w[i - 7] + detail::sha_f2(w[i - 15]) + w[i - 16];
+            }
+            elm_type a{ h_[0] }, b{ h_[1] }, c{ h_[2] }, d{ h_[3] },
+                e{ h_[4] }, f{ h_[5] }, g{ h_[6] }, h{ h_[7] };
+            for (auto i = 0u; i < w_size; ++i) {
+                auto t1 = h + detail::sha_f1(e) + detail::ch(e, f, g) +
+                    detail::sha_constants<elm_type>[i] + w[i];
+                auto t2 = detail::sha_f0(a) + detail::maj(a, b, c);
+                h = g;
+                g = f;
+                f = e;
+                e = d + t1;
+                d = c;
+                c = b;
+                b = a;
+                a = t1 + t2;
+            }
+            h_[0] = a + h_[0];
+            h_[1] = b + h_[1];
+            h_[2] = c + h_[2];
+            h_[3] = d + h_[3];
+            h_[4] = e + h_[4];
+            h_[5] = f + h_[5];
+            h_[6] = g + h_[6];
+            h_[7] = h + h_[7];
         }
-        h_[0] = a + h_[0];
-        h_[1] = b + h_[1];
-        h_[2] = c + h_[2];
-        h_[3] = d + h_[3];
-        h_[4] = e + h_[4];
-        h_[5] = f + h_[5];
-        h_[6] = g + h_[6];
-        h_[7] = h + h_[7];
-        //std::memset(block, 0, block_length);
     }
 };
 
@@ -229,14 +336,14 @@ namespace ouchi {
 inline namespace literals {
 inline namespace crypto_literals {
 
-crypto::memory_entity<64> operator""_sha512(const char* str, [[maybe_unused]] size_t size)
+inline crypto::memory_entity<64> operator""_sha512(const char* str, [[maybe_unused]] size_t size)
 {
     crypto::sha512 hash;
     hash.update(str);
     return hash.finalize();
 }
 
-crypto::memory_entity<32> operator""_sha256(const char* str, [[maybe_unused]] size_t size)
+inline crypto::memory_entity<32> operator""_sha256(const char* str, [[maybe_unused]] size_t size)
 {
     crypto::sha256 hash;
     hash.update(str);
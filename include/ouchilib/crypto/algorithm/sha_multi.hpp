@@ -0,0 +1,349 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <stdexcept>
+#include "sha.hpp"
+#include "../common.hpp"
+#ifdef OUCHI_CRYPTO_X86
+#   include <immintrin.h>
+#   include "../cpu_features.hpp"
+#endif
+
+namespace ouchi::crypto {
+
+namespace detail {
+
+#ifdef OUCHI_CRYPTO_X86
+// lanes of Int in a 256 bit vector
+template<class Int>
+struct sha_avx2_ops {
+    using vec = __m256i;
+    static constexpr size_t lanes = 32 / sizeof(Int);
+
+    OUCHI_TARGET("avx2") static vec add(vec a, vec b) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm256_add_epi32(a, b);
+        else return _mm256_add_epi64(a, b);
+    }
+    OUCHI_TARGET("avx2") static vec xor_(vec a, vec b) noexcept { return _mm256_xor_si256(a, b); }
+    OUCHI_TARGET("avx2") static vec and_(vec a, vec b) noexcept { return _mm256_and_si256(a, b); }
+    OUCHI_TARGET("avx2") static vec or_(vec a, vec b) noexcept { return _mm256_or_si256(a, b); }
+    // ~a & b
+    OUCHI_TARGET("avx2") static vec andnot(vec a, vec b) noexcept { return _mm256_andnot_si256(a, b); }
+    template<int N>
+    OUCHI_TARGET("avx2") static vec shr(vec a) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm256_srli_epi32(a, N);
+        else return _mm256_srli_epi64(a, N);
+    }
+    template<int N>
+    OUCHI_TARGET("avx2") static vec ror(vec a) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm256_or_si256(_mm256_srli_epi32(a, N), _mm256_slli_epi32(a, 32 - N));
+        else return _mm256_or_si256(_mm256_srli_epi64(a, N), _mm256_slli_epi64(a, 64 - N));
+    }
+    OUCHI_TARGET("avx2") static vec set1(Int x) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm256_set1_epi32((int)x);
+        else return _mm256_set1_epi64x((long long)x);
+    }
+    OUCHI_TARGET("avx2") static vec load(const Int* p) noexcept { return _mm256_loadu_si256(reinterpret_cast<const vec*>(p)); }
+    OUCHI_TARGET("avx2") static void store(Int* p, vec a) noexcept { _mm256_storeu_si256(reinterpret_cast<vec*>(p), a); }
+};
+
+// lanes of Int in a 512 bit vector
+template<class Int>
+struct sha_avx512_ops {
+    using vec = __m512i;
+    static constexpr size_t lanes = 64 / sizeof(Int);
+
+    OUCHI_TARGET("avx512f") static vec add(vec a, vec b) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm512_add_epi32(a, b);
+        else return _mm512_add_epi64(a, b);
+    }
+    OUCHI_TARGET("avx512f") static vec xor_(vec a, vec b) noexcept { return _mm512_xor_si512(a, b); }
+    OUCHI_TARGET("avx512f") static vec and_(vec a, vec b) noexcept { return _mm512_and_si512(a, b); }
+    OUCHI_TARGET("avx512f") static vec or_(vec a, vec b) noexcept { return _mm512_or_si512(a, b); }
+    OUCHI_TARGET("avx512f") static vec andnot(vec a, vec b) noexcept { return _mm512_andnot_si512(a, b); }
+    template<int N>
+    OUCHI_TARGET("avx512f") static vec shr(vec a) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm512_srli_epi32(a, N);
+        else return _mm512_srli_epi64(a, N);
+    }
+    template<int N>
+    OUCHI_TARGET("avx512f") static vec ror(vec a) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm512_ror_epi32(a, N);
+        else return _mm512_ror_epi64(a, N);
+    }
+    OUCHI_TARGET("avx512f") static vec set1(Int x) noexcept
+    {
+        if constexpr (sizeof(Int) == 4) return _mm512_set1_epi32((int)x);
+        else return _mm512_set1_epi64((long long)x);
+    }
+    OUCHI_TARGET("avx512f") static vec load(const Int* p) noexcept { return _mm512_loadu_si512(p); }
+    OUCHI_TARGET("avx512f") static void store(Int* p, vec a) noexcept { _mm512_storeu_si512(p, a); }
+};
+
+// sha_f0 .. sha_f3 on every lane
+template<class Ops, class Int, int R0, int R1, int R2, bool Shift>
+OUCHI_FORCEINLINE typename Ops::vec sha_sigma_lanes(typename Ops::vec x) noexcept
+{
+    auto r = Ops::xor_(Ops::template ror<R0>(x), Ops::template ror<R1>(x));
+    if constexpr (Shift) return Ops::xor_(r, Ops::template shr<R2>(x));
+    else return Ops::xor_(r, Ops::template ror<R2>(x));
+}
+template<class Ops, class Int>
+OUCHI_FORCEINLINE typename Ops::vec sha_f0_lanes(typename Ops::vec x) noexcept
+{
+    if constexpr (sizeof(Int) == 4) return sha_sigma_lanes<Ops, Int, 2, 13, 22, false>(x);
+    else return sha_sigma_lanes<Ops, Int, 28, 34, 39, false>(x);
+}
+template<class Ops, class Int>
+OUCHI_FORCEINLINE typename Ops::vec sha_f1_lanes(typename Ops::vec x) noexcept
+{
+    if constexpr (sizeof(Int) == 4) return sha_sigma_lanes<Ops, Int, 6, 11, 25, false>(x);
+    else return sha_sigma_lanes<Ops, Int, 14, 18, 41, false>(x);
+}
+template<class Ops, class Int>
+OUCHI_FORCEINLINE typename Ops::vec sha_f2_lanes(typename Ops::vec x) noexcept
+{
+    if constexpr (sizeof(Int) == 4) return sha_sigma_lanes<Ops, Int, 7, 18, 3, true>(x);
+    else return sha_sigma_lanes<Ops, Int, 1, 8, 7, true>(x);
+}
+template<class Ops, class Int>
+OUCHI_FORCEINLINE typename Ops::vec sha_f3_lanes(typename Ops::vec x) noexcept
+{
+    if constexpr (sizeof(Int) == 4) return sha_sigma_lanes<Ops, Int, 17, 19, 10, true>(x);
+    else return sha_sigma_lanes<Ops, Int, 19, 61, 6, true>(x);
+}
+
+// one block of every lane. state[j * lanes + l] is word j of lane l, words[t * lanes + l] is word t of the block of lane l.
+// the same rounds as sha::process_block on a vector per word.
+template<class Ops, class Int>
+OUCHI_FORCEINLINE void sha_compress_lanes(Int* state, const Int* words) noexcept
+{
+    using vec = typename Ops::vec;
+    constexpr size_t lanes = Ops::lanes;
+    constexpr size_t rounds = sizeof(Int) == 4 ? 64 : 80;
+    vec w[16];
+    vec s[8];
+    for (size_t j = 0; j < 8; ++j) s[j] = Ops::load(state + j * lanes);
+    vec a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+    for (size_t t = 0; t < rounds; ++t) {
+        vec wt;
+        if (t < 16) {
+            wt = w[t] = Ops::load(words + t * lanes);
+        } else {
+            wt = w[t & 15] = Ops::add(Ops::add(sha_f3_lanes<Ops, Int>(w[(t - 2) & 15]), w[(t - 7) & 15]),
+                                      Ops::add(sha_f2_lanes<Ops, Int>(w[(t - 15) & 15]), w[t & 15]));
+        }
+        auto ch = Ops::xor_(Ops::and_(e, f), Ops::andnot(e, g));
+        auto maj = Ops::or_(Ops::and_(a, b), Ops::and_(c, Ops::or_(a, b)));
+        auto t1 = Ops::add(Ops::add(Ops::add(h, sha_f1_lanes<Ops, Int>(e)), Ops::add(ch, Ops::set1(sha_constants<Int>[t]))), wt);
+        auto t2 = Ops::add(sha_f0_lanes<Ops, Int>(a), maj);
+        h = g;
+        g = f;
+        f = e;
+        e = Ops::add(d, t1);
+        d = c;
+        c = b;
+        b = a;
+        a = Ops::add(t1, t2);
+    }
+    vec r[8] = { a, b, c, d, e, f, g, h };
+    for (size_t j = 0; j < 8; ++j) Ops::store(state + j * lanes, Ops::add(s[j], r[j]));
+}
+#endif
+
+} // namespace detail
+
+enum class sha_multi_backend {
+    scalar,  // sha one message after another
+    avx2,
+    avx512,
+};
+
+/// <summary>
+/// hashes many independent messages at once, one message per simd lane.
+/// 8 lanes of sha256 or 4 of sha512 on avx2, twice as many on avx-512.
+/// a lane takes the next message as soon as its message is done, so messages of any length can be mixed.
+/// every digest is the same as the one of sha<Len>.
+/// </summary>
+template<int Len>
+class sha_multi {
+    static_assert(Len == 256 || Len == 512);
+    using elm_type = std::conditional_t<(Len > 256), std::uint64_t, std::uint32_t>;
+    static constexpr size_t block_length = 16 * sizeof(elm_type);
+    static constexpr size_t length_field = 2 * sizeof(elm_type);
+public:
+    using digest_t = memory_entity<Len / 8>;
+
+    static bool supported(sha_multi_backend backend) noexcept
+    {
+#ifdef OUCHI_CRYPTO_X86
+        auto& f = cpu_features::get();
+        switch (backend) {
+        case sha_multi_backend::avx2: return f.avx2;
+        case sha_multi_backend::avx512: return f.avx512f;
+        default: return true;
+        }
+#else
+        return backend == sha_multi_backend::scalar;
+#endif
+    }
+    static sha_multi_backend best_backend() noexcept
+    {
+        if (supported(sha_multi_backend::avx512)) return sha_multi_backend::avx512;
+        if (supported(sha_multi_backend::avx2)) return sha_multi_backend::avx2;
+        return sha_multi_backend::scalar;
+    }
+    static size_t lanes(sha_multi_backend backend) noexcept
+    {
+        switch (backend) {
+        case sha_multi_backend::avx2: return 32 / sizeof(elm_type);
+        case sha_multi_backend::avx512: return 64 / sizeof(elm_type);
+        default: return 1;
+        }
+    }
+
+    // digests[i] is the hash of sizes[i] bytes from messages[i]
+    static void hash(const void* const* messages, const size_t* sizes, size_t count, digest_t* digests)
+    {
+        hash(messages, sizes, count, digests, best_backend());
+    }
+    // throws std::invalid_argument if the cpu does not support backend
+    static void hash(const void* const* messages, const size_t* sizes, size_t count, digest_t* digests,
+                     sha_multi_backend backend)
+    {
+        if (!supported(backend)) throw std::invalid_argument("sha_multi: backend is not supported by this cpu");
+        switch (backend) {
+#ifdef OUCHI_CRYPTO_X86
+        case sha_multi_backend::avx2:
+            run<detail::sha_avx2_ops<elm_type>::lanes>(messages, sizes, count, digests, &compress_avx2);
+            break;
+        case sha_multi_backend::avx512:
+            run<detail::sha_avx512_ops<elm_type>::lanes>(messages, sizes, count, digests, &compress_avx512);
+            break;
+#endif
+        default:
+            for (size_t i = 0; i < count; ++i) {
+                sha<Len> s;
+                s.update(messages[i], sizes[i]);
+                digests[i] = s.finalize();
+            }
+        }
+    }
+    static void hash(const std::string_view* messages, size_t count, digest_t* digests)
+    {
+        hash(messages, count, digests, best_backend());
+    }
+    static void hash(const std::string_view* messages, size_t count, digest_t* digests, sha_multi_backend backend)
+    {
+        constexpr size_t batch = 64;
+        const void* ptrs[batch];
+        size_t sizes[batch];
+        for (size_t i = 0; i < count; i += batch) {
+            auto n = std::min(batch, count - i);
+            for (size_t j = 0; j < n; ++j) ptrs[j] = messages[i + j].data(), sizes[j] = messages[i + j].size();
+            hash(ptrs, sizes, n, digests + i, backend);
+        }
+    }
+private:
+#ifdef OUCHI_CRYPTO_X86
+    OUCHI_TARGET("avx2")
+    static void compress_avx2(elm_type* state, const elm_type* words) noexcept
+    {
+        detail::sha_compress_lanes<detail::sha_avx2_ops<elm_type>>(state, words);
+    }
+    OUCHI_TARGET("avx512f")
+    static void compress_avx512(elm_type* state, const elm_type* words) noexcept
+    {
+        detail::sha_compress_lanes<detail::sha_avx512_ops<elm_type>>(state, words);
+    }
+#endif
+
+    // a message in a lane. whole blocks are read in place, the padded rest from tail.
+    struct lane {
+        size_t index;
+        const std::uint8_t* next;
+        size_t whole_blocks;
+        std::uint8_t tail[2 * block_length];
+        size_t tail_blocks;
+        size_t tail_pos;
+        bool active = false;
+
+        void start(size_t i, const void* message, size_t size) noexcept
+        {
+            index = i;
+            next = static_cast<const std::uint8_t*>(message);
+            whole_blocks = size / block_length;
+            auto rest = size % block_length;
+            tail_blocks = rest + 1 + length_field <= block_length ? 1 : 2;
+            tail_pos = 0;
+            std::memset(tail, 0, sizeof tail);
+            if (rest) std::memcpy(tail, next + whole_blocks * block_length, rest);
+            tail[rest] = 0x80;
+            // the upper half of sha512's 128 bit length is zero
+            detail::unpack(static_cast<std::uint64_t>(size) * 8, tail + tail_blocks * block_length - 8);
+            active = true;
+        }
+        const std::uint8_t* next_block() noexcept
+        {
+            if (whole_blocks) {
+                --whole_blocks;
+                auto p = next;
+                next += block_length;
+                return p;
+            }
+            return tail + block_length * tail_pos++;
+        }
+        bool done() const noexcept { return whole_blocks == 0 && tail_pos == tail_blocks; }
+    };
+
+    template<size_t Lanes>
+    static void run(const void* const* messages, const size_t* sizes, size_t count, digest_t* digests,
+                    void (*compress)(elm_type*, const elm_type*) noexcept)
+    {
+        lane lanes[Lanes];
+        elm_type state[8 * Lanes] = {};
+        elm_type words[16 * Lanes] = {};
+        size_t next_message = 0;
+        size_t active = 0;
+        auto start = [&](size_t l) {
+            if (next_message == count) {
+                lanes[l].active = false;
+                return;
+            }
+            lanes[l].start(next_message, messages[next_message], sizes[next_message]);
+            ++next_message;
+            ++active;
+            for (size_t j = 0; j < 8; ++j) state[j * Lanes + l] = detail::initial_hash_value<elm_type>[j];
+        };
+        for (size_t l = 0; l < Lanes; ++l) start(l);
+        while (active) {
+            for (size_t l = 0; l < Lanes; ++l) {
+                if (!lanes[l].active) continue;
+                auto* block = lanes[l].next_block();
+                for (size_t t = 0; t < 16; ++t) words[t * Lanes + l] = detail::pack<elm_type>(block + t * sizeof(elm_type));
+            }
+            compress(state, words);
+            for (size_t l = 0; l < Lanes; ++l) {
+                if (!lanes[l].active || !lanes[l].done()) continue;
+                auto& digest = digests[lanes[l].index];
+                for (size_t j = 0; j < 8; ++j) detail::unpack(state[j * Lanes + l], digest.data + j * sizeof(elm_type));
+                --active;
+                start(l);
+            }
+        }
+        secure_memset(words, 0);
+    }
+};
+
+using sha256_multi = sha_multi<256>;
+using sha512_multi = sha_multi<512>;
+
+}
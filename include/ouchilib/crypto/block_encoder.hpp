@@ -5,180 +5,304 @@
 #include <ostream>
 #include <stdexcept>
 #include <algorithm>
+#include <mutex>
+#include <vector>
+#include <thread>
 #include "cipher_mode.hpp"
 #include "ouchilib/thread/thread-pool.hpp"
+#include "ouchilib/thread/parallel.hpp"
 
 namespace ouchi::crypto {
 
+// pool of the parallel functions of block_encoder called without one. made on first use.
+inline ouchi::thread::thread_pool& shared_thread_pool()
+{
+    static ouchi::thread::thread_pool tp(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return tp;
+}
+
+/// <summary>
+/// encrypts and decrypts whole texts with a block cipher in a mode of operation.
+/// an encoder of an authenticated mode (gcm) handles exactly one message : once the tag is written or checked,
+/// every further call throws std::logic_error. the next message needs a new encoder with a fresh iv.
+/// </summary>
 template<
     template<class> class CipherMode,
     class Algorithm,
     std::enable_if_t<is_crypto_algorithm<Algorithm>::value>* = nullptr>
 class block_encoder {
+    static constexpr bool is_authenticated = is_authenticated_mode<CipherMode<Algorithm>>::value;
 public:
     template<class ...Args>
     block_encoder(std::in_place_t, Args&& ...args)
         : cipher_device_(std::in_place, std::forward<Args>(args)...)
     {}
+    ~block_encoder()
+    {
+        secure_memset(pending_, 0);
+    }
+    // additional authenticated data of an authenticated mode. call before the text.
+    template<class Cm = CipherMode<Algorithm>>
+    auto set_aad(const void* aad, size_t size)
+        ->std::enable_if_t<is_authenticated_mode<Cm>::value>
+    {
+        check_untagged();
+        cipher_device_.set_aad(aad, size);
+    }
     ///<returns>crypto size</returns>
     size_t encrypt(const void* src, size_t size, void* dest, size_t dest_size)
     {
-        auto padsize = check_edestsize(size, dest_size);
+        if constexpr (is_authenticated) {
+            check_untagged();
+            check_tagged_edestsize(size, dest_size);
+            std::memmove(dest, src, size);
+            auto destptr = static_cast<std::uint8_t*>(dest);
+            cipher_device_.encrypt_blocks(destptr, destptr, size / Algorithm::block_size);
+            return finish_encrypt(destptr, destptr, size);
+        } else {
+            auto padsize = check_edestsize(size, dest_size);
 
-        std::memmove(dest, src, size);
-        dest_size = size + padsize;
+            std::memmove(dest, src, size);
+            dest_size = size + padsize;
 
-        auto destptr = static_cast<std::uint8_t*>(dest);
-        pad(destptr, size, padsize);
-        for (auto i = 0ull; i < dest_size; i +=Algorithm::block_size) {
-            cipher_device_.encrypt(destptr + i, destptr + i);
+            auto destptr = static_cast<std::uint8_t*>(dest);
+            pad(destptr, size, padsize);
+            cipher_device_.encrypt_blocks(destptr, destptr, dest_size / Algorithm::block_size);
+            return dest_size;
         }
-        return dest_size;
     }
     ///<returns>plain txt size</returns>
     size_t decrypt(const void* src, size_t size, void* dest, size_t dest_size)
     {
-        check_ddestsize(size, dest_size);
-        dest_size = size;
+        if constexpr (is_authenticated) {
+            check_untagged();
+            auto textsize = check_tagged_ddestsize(size, dest_size);
+            auto srcptr = static_cast<const std::uint8_t*>(src);
+            auto destptr = static_cast<std::uint8_t*>(dest);
+            cipher_device_.decrypt_blocks(srcptr, destptr, textsize / Algorithm::block_size);
+            return finish_decrypt(srcptr, destptr, textsize);
+        } else {
+            check_ddestsize(size, dest_size);
+            dest_size = size;
 
-        auto destptr = static_cast<std::uint8_t*>(dest);
-        auto srcptr = static_cast<const std::uint8_t*>(src);
-        for (auto i = 0ull; i < dest_size; i += Algorithm::block_size) {
-            cipher_device_.decrypt(srcptr + i, destptr + i);
+            auto destptr = static_cast<std::uint8_t*>(dest);
+            cipher_device_.decrypt_blocks(src, destptr, dest_size / Algorithm::block_size);
+            // delete pad
+            auto padsize = destptr[dest_size - 1];
+            check_pad(padsize, destptr + dest_size - padsize);
+            return dest_size - padsize;
         }
-        // delete pad
-        auto padsize = destptr[dest_size - 1];
-        check_pad(padsize, destptr + dest_size - padsize);
-        return dest_size - padsize;
     }
     /// <summary>
     /// 並列に暗号化する。このメソッドは暗号利用モードが並列暗号化に対応している場合のみwell-formed
+    /// srcを読んでdestに直接書く。srcとdestは重なってはならない
     /// </summary>
     /// <param name="src">平文</param>
     /// <param name="size">平文のサイズ</param>
     /// <param name="dest">暗号文のためのバッファ</param>
     /// <param name="dest_size">バッファのサイズ</param>
-    /// <param name="thread_cnt">スレッド数</param>
+    /// <param name="pool">使用するスレッドプール。呼び出し元のスレッドも処理に加わる</param>
     /// <returns>暗号文のサイズ</returns>
-    template<class Cm = CipherMode<Algorithm>>
+    template<class Pool, class Cm = CipherMode<Algorithm>>
+        requires requires(Pool& p) { p.size(); }
     auto encrypt_parallel(const void* src, size_t size,
-                            void* dest, size_t dest_size,
-                            unsigned thread_cnt)
+                          void* dest, size_t dest_size,
+                          Pool& pool)
         ->std::enable_if_t<Cm::is_encrypt_parallelizable, size_t>
     {
-        assert(thread_cnt);
-        auto device = cipher_device_;
-        auto padsize = check_edestsize(size, dest_size);
+        constexpr auto bs = Algorithm::block_size;
+        auto srcptr = static_cast<const std::uint8_t*>(src);
         auto destptr = static_cast<std::uint8_t*>(dest);
-        ouchi::thread::thread_pool tp(thread_cnt);
-
-        std::memmove(dest, src, size);
-        dest_size = size + padsize;
-        pad(dest, size, padsize);
-        {
-            const memory_iterator<Algorithm::block_size> first(dest, dest_size);
-            const memory_iterator<Algorithm::block_size> last(destptr + dest_size, 0);
-            memory_iterator<Algorithm::block_size> it(dest, dest_size);
-            auto width = first.count() / thread_cnt;
-            for ([[maybe_unused]] auto i : ouchi::step(thread_cnt - 1)) {
-                tp.push([device, first, it, width]() mutable {
-                    auto end = it + width;
-                    if(it != first) device.set_encrypt_state(first, it - 1);
-                    for (; it != end; ++it) {
-                        device.encrypt(*it, it.raw());
-                    }
-                });
-                it = it + width;
-            }
-            tp.push([device, first, it, last]() mutable {
-                if (it != first) device.set_encrypt_state(first, it - 1);
-                device.set_encrypt_state(first, it - 1);
-                for (; it != last; ++it) {
-                    device.encrypt(*it, it.raw());
-                }
+        if constexpr (is_authenticated) {
+            check_untagged();
+            check_tagged_edestsize(size, dest_size);
+            process_chunks(pool, srcptr, destptr, size / bs, [](auto& device, const std::uint8_t* in, std::uint8_t* out, size_t n) {
+                device.encrypt_blocks(in, out, n);
+            });
+            return finish_encrypt(srcptr, destptr, size);
+        } else {
+            auto padsize = check_edestsize(size, dest_size);
+            // the padded last block is made in dest and encrypted in place
+            auto whole = size / bs;
+            std::memcpy(destptr + whole * bs, srcptr + whole * bs, size - whole * bs);
+            pad(destptr, size, padsize);
+            dest_size = size + padsize;
+            const memory_iterator<bs> first(dest, dest_size);
+            ouchi::thread::parallel_for_chunk(pool, size_t{ 0 }, first.count(), [this, first, srcptr, destptr, whole](size_t b, size_t e) {
+                auto device = cipher_device_;
+                if (b) device.set_encrypt_state(first, first + (b - 1));
+                auto m = std::min(e, whole);
+                if (b < m) device.encrypt_blocks(srcptr + b * bs, destptr + b * bs, m - b);
+                if (e > whole) device.encrypt_blocks(destptr + whole * bs, destptr + whole * bs, 1);
             });
+            return dest_size;
         }
-        tp.wait();
-        return dest_size;
     }
+    // on the pool shared by every block_encoder
+    template<class Cm = CipherMode<Algorithm>>
+    auto encrypt_parallel(const void* src, size_t size,
+                          void* dest, size_t dest_size)
+        ->std::enable_if_t<Cm::is_encrypt_parallelizable, size_t>
+    {
+        return encrypt_parallel(src, size, dest, dest_size, shared_thread_pool());
+    }
+    // on a pool of thread_cnt - 1 threads made for this call. thread_cnt <= 1 runs encrypt() on this thread
     template<class Cm = CipherMode<Algorithm>>
+    auto encrypt_parallel(const void* src, size_t size,
+                          void* dest, size_t dest_size,
+                          unsigned thread_cnt)
+        ->std::enable_if_t<Cm::is_encrypt_parallelizable, size_t>
+    {
+        if (thread_cnt <= 1) return encrypt(src, size, dest, dest_size);
+        ouchi::thread::thread_pool tp(thread_cnt - 1);
+        return encrypt_parallel(src, size, dest, dest_size, tp);
+    }
+    /// <summary>
+    /// 並列に復号する。srcとdestは重なってはならない
+    /// </summary>
+    template<class Pool, class Cm = CipherMode<Algorithm>>
+        requires requires(Pool& p) { p.size(); }
     auto decrypt_parallel(const void* src, size_t size,
-                            void* dest, size_t dest_size,
-                            unsigned thread_cnt)
+                          void* dest, size_t dest_size,
+                          Pool& pool)
         ->std::enable_if_t<Cm::is_decrypt_parallelizable, size_t>
     {
-        assert(thread_cnt);
-        check_ddestsize(size, dest_size);
-        dest_size = size;
-        ouchi::thread::thread_pool tp(thread_cnt);
-        auto device = cipher_device_;
-        auto destptr = static_cast<std::uint8_t*>(dest);
+        constexpr auto bs = Algorithm::block_size;
         auto srcptr = static_cast<const std::uint8_t*>(src);
-        std::memmove(destptr, srcptr, size);
-        // decryption
-        {
-            const memory_iterator<Algorithm::block_size> first(dest, dest_size);
-            const memory_iterator<Algorithm::block_size> last(destptr + dest_size, 0);
-            memory_iterator<Algorithm::block_size> it(dest, dest_size);
-            auto width = first.count() / thread_cnt;
-            for ([[maybe_unused]] auto i : ouchi::step(thread_cnt - 1)) {
-                tp.push([device, first, it, width]() mutable {
-                    auto end = it + width;
-                    if(it != first) device.set_decrypt_state(first, it - 1);
-                    for (; it != end; ++it) {
-                        device.decrypt(*it, it.raw());
-                    }
-                });
-                it = it + width;
-            }
-            tp.push([device, first, it, last, dest]() mutable {
-                if (it != first) device.set_decrypt_state(first, it - 1);
-                for (; it != last; ++it) {
-                    device.decrypt(*it, it.raw());
-                }
+        auto destptr = static_cast<std::uint8_t*>(dest);
+        if constexpr (is_authenticated) {
+            check_untagged();
+            auto textsize = check_tagged_ddestsize(size, dest_size);
+            process_chunks(pool, srcptr, destptr, textsize / bs, [](auto& device, const std::uint8_t* in, std::uint8_t* out, size_t n) {
+                device.decrypt_blocks(in, out, n);
+            });
+            return finish_decrypt(srcptr, destptr, textsize);
+        } else {
+            check_ddestsize(size, dest_size);
+            // chunk state is taken from the cipher text in src
+            const memory_iterator<bs> src_first(const_cast<std::uint8_t*>(srcptr), size);
+            ouchi::thread::parallel_for_chunk(pool, size_t{ 0 }, src_first.count(), [this, src_first, srcptr, destptr](size_t b, size_t e) {
+                auto device = cipher_device_;
+                if (b) device.set_decrypt_state(src_first, src_first + (b - 1));
+                device.decrypt_blocks(srcptr + b * bs, destptr + b * bs, e - b);
             });
-        }
-        tp.wait();
 
-        // delete pad
-        auto padsize = destptr[dest_size - 1];
-        check_pad(padsize, destptr + dest_size - padsize);
-        return dest_size - padsize;
+            // delete pad
+            auto padsize = destptr[size - 1];
+            check_pad(padsize, destptr + size - padsize);
+            return size - padsize;
+        }
     }
-    void encrypt(std::istream& plain, std::ostream& crypto)
+    template<class Cm = CipherMode<Algorithm>>
+    auto decrypt_parallel(const void* src, size_t size,
+                          void* dest, size_t dest_size)
+        ->std::enable_if_t<Cm::is_decrypt_parallelizable, size_t>
+    {
+        return decrypt_parallel(src, size, dest, dest_size, shared_thread_pool());
+    }
+    // on a pool of thread_cnt - 1 threads made for this call. thread_cnt <= 1 runs decrypt() on this thread
+    template<class Cm = CipherMode<Algorithm>>
+    auto decrypt_parallel(const void* src, size_t size,
+                          void* dest, size_t dest_size,
+                          unsigned thread_cnt)
+        ->std::enable_if_t<Cm::is_decrypt_parallelizable, size_t>
+    {
+        if (thread_cnt <= 1) return decrypt(src, size, dest, dest_size);
+        ouchi::thread::thread_pool tp(thread_cnt - 1);
+        return decrypt_parallel(src, size, dest, dest_size, tp);
+    }
+    /// <summary>
+    /// decrypts size bytes at offset of the text encrypted from the start of this encoder.
+    /// src holds just those bytes of the cipher text, so a record costs its own size wherever it is.
+    /// well-formed only for modes with random access (ctr).
+    /// </summary>
+    template<class Cm = CipherMode<Algorithm>>
+    auto decrypt_at(size_t offset, const void* src, size_t size, void* dest) const
+        ->decltype(std::declval<const Cm&>().crypt_at(offset, src, dest, size))
     {
-        constexpr auto cnt = Algorithm::block_size;
-        memory_entity<cnt> block;
-        while (plain.read(reinterpret_cast<char*>(block.data), cnt).gcount() == cnt) {
-            cipher_device_.encrypt(block.data, block.data);
-            crypto.write(reinterpret_cast<char*>(block.data), cnt);
+        cipher_device_.crypt_at(offset, src, dest, size);
+    }
+    /// <summary>
+    /// incremental encryption. takes any amount of text and writes the whole blocks it can,
+    /// keeping the rest (less than block_size bytes) for the next call or encrypt_finalize.
+    /// at most size + block_size - 1 bytes are written.
+    /// </summary>
+    ///<returns>written size</returns>
+    size_t encrypt_update(const void* src, size_t size, void* dest, size_t dest_size)
+    {
+        check_untagged();
+        return feed(src, size, dest, dest_size, 0, [this](const std::uint8_t* in, std::uint8_t* out, size_t n) {
+            cipher_device_.encrypt_blocks(in, out, n);
+        });
+    }
+    /// <summary>
+    /// writes the kept text with the padding, or with the tag for authenticated modes.
+    /// at most block_size (+ tag_size) bytes are written.
+    /// </summary>
+    ///<returns>written size</returns>
+    size_t encrypt_finalize(void* dest, size_t dest_size)
+    {
+        check_untagged();
+        auto destptr = static_cast<std::uint8_t*>(dest);
+        auto size = pending_size_;
+        pending_size_ = 0;
+        if constexpr (is_authenticated) {
+            check_tagged_edestsize(size, dest_size);
+            return finish_encrypt(pending_, destptr, size);
+        } else {
+            if (dest_size < Algorithm::block_size) throw std::out_of_range("dest is too short");
+            auto padsize = Algorithm::block_size - size;
+            std::memcpy(destptr, pending_, size);
+            pad(destptr, size, padsize);
+            cipher_device_.encrypt_blocks(destptr, destptr, 1);
+            return Algorithm::block_size;
         }
-        auto padbegin = plain.gcount();
-        auto padsize = cnt - padbegin;
-        std::fill(block.data + padbegin, std::end(block.data), (std::uint8_t)padsize);
-        cipher_device_.encrypt(block.data, block.data);
-        crypto.write(reinterpret_cast<char*>(block.data), cnt);
     }
-    void decrypt(std::istream& crypto, std::ostream& plain)
+    /// <summary>
+    /// incremental decryption. the last block (the tag for authenticated modes) is held back until decrypt_finalize.
+    /// at most size + block_size - 1 bytes are written.
+    /// authenticated modes release the plain text before the tag is checked.
+    /// </summary>
+    ///<returns>written size</returns>
+    size_t decrypt_update(const void* src, size_t size, void* dest, size_t dest_size)
     {
-        constexpr auto cnt = Algorithm::block_size;
-        memory_entity<Algorithm::block_size> block;
-        while (true) {
-            crypto.read(reinterpret_cast<char*>(block.data), cnt);
-            if (crypto.gcount() != cnt) throw std::runtime_error("decryption failed. invalid length");
-            cipher_device_.decrypt(block.data, block.data);
-            crypto.ignore(1);
-            if (!crypto.eof()) {
-                plain.write(reinterpret_cast<char*>(block.data), cnt);
-            } else {
-                auto padsize = block[cnt - 1];
-                check_pad(padsize, block.data + cnt - padsize);
-                plain.write(reinterpret_cast<char*>(block.data), cnt - padsize);
-                break;
-            }
-            crypto.seekg(-1, std::ios_base::cur);
+        check_untagged();
+        return feed(src, size, dest, dest_size, held_back_size, [this](const std::uint8_t* in, std::uint8_t* out, size_t n) {
+            cipher_device_.decrypt_blocks(in, out, n);
+        });
+    }
+    /// <summary>
+    /// decrypts the held back text and removes the padding, or checks the tag.
+    /// at most block_size - 1 bytes are written.
+    /// </summary>
+    ///<returns>written size</returns>
+    size_t decrypt_finalize(void* dest, size_t dest_size)
+    {
+        check_untagged();
+        auto destptr = static_cast<std::uint8_t*>(dest);
+        auto size = pending_size_;
+        pending_size_ = 0;
+        if constexpr (is_authenticated) {
+            auto textsize = check_tagged_ddestsize(size, dest_size);
+            return finish_decrypt(pending_, destptr, textsize);
+        } else {
+            if (size != Algorithm::block_size) throw std::runtime_error("decryption failed. invalid length");
+            cipher_device_.decrypt_blocks(pending_, pending_, 1);
+            auto padsize = pending_[size - 1];
+            check_pad(padsize, pending_ + size - padsize);
+            if (dest_size < size - padsize) throw std::out_of_range("dest is too short");
+            std::memcpy(destptr, pending_, size - padsize);
+            return size - padsize;
         }
     }
+    void encrypt(std::istream& plain, std::ostream& crypto)
+    {
+        process_stream(plain, crypto, &block_encoder::encrypt_update, &block_encoder::encrypt_finalize);
+    }
+    void decrypt(std::istream& crypto, std::ostream& plain)
+    {
+        process_stream(crypto, plain, &block_encoder::decrypt_update, &block_encoder::decrypt_finalize);
+    }
 private:
     static void pad(void* dest, size_t srcsize, size_t padsize)
     {
@@ -207,7 +331,121 @@ private:
              (size_t)std::count(padbegin, padbegin + padsize, (std::uint8_t)padsize) == padsize))
             throw std::runtime_error("decryption failed. please check key or initial condition.");
     }
+    // authenticated modes : the tag follows the unpadded text
+    template<class Cm = CipherMode<Algorithm>>
+    static void check_tagged_edestsize(size_t srcsize, size_t dest_size)
+    {
+        if (dest_size < srcsize || dest_size - srcsize < Cm::tag_size)
+            throw std::out_of_range("dest is too short");
+    }
+    ///<returns>text size without the tag</returns>
+    template<class Cm = CipherMode<Algorithm>>
+    static size_t check_tagged_ddestsize(size_t srcsize, size_t dest_size)
+    {
+        if (srcsize < Cm::tag_size)
+            throw std::invalid_argument("invalid length : size must be at least the tag size");
+        if (dest_size < srcsize - Cm::tag_size)
+            throw std::out_of_range("dest is too short");
+        return srcsize - Cm::tag_size;
+    }
+    // the counter and the hash of an authenticated mode belong to one message
+    void check_untagged() const
+    {
+        if constexpr (is_authenticated) {
+            if (tagged_) throw std::logic_error("the message is already tagged. encrypt the next one with a new encoder and a fresh iv");
+        }
+    }
+    // whole blocks are done, dest + size is followed by the tag
+    size_t finish_encrypt(const std::uint8_t* src, std::uint8_t* dest, size_t size)
+    {
+        tagged_ = true;
+        auto whole = size / Algorithm::block_size * Algorithm::block_size;
+        cipher_device_.encrypt_tail(src + whole, dest + whole, size - whole);
+        cipher_device_.get_tag(dest + size);
+        return size + CipherMode<Algorithm>::tag_size;
+    }
+    // the plain text is wiped unless the tag matches
+    size_t finish_decrypt(const std::uint8_t* src, std::uint8_t* dest, size_t size)
+    {
+        tagged_ = true;
+        auto whole = size / Algorithm::block_size * Algorithm::block_size;
+        cipher_device_.decrypt_tail(src + whole, dest + whole, size - whole);
+        if (!cipher_device_.verify_tag(src + size)) {
+            secure_memset(dest, 0, size);
+            throw std::runtime_error("decryption failed. authentication tag mismatch.");
+        }
+        return size;
+    }
+    // every chunk is processed by a copy of the device from its own position,
+    // then merged into the device that has skipped the whole run
+    template<class Pool, class F>
+    void process_chunks(Pool& pool, const std::uint8_t* src, std::uint8_t* dest, size_t nblocks, F f)
+    {
+        const auto base = cipher_device_;
+        cipher_device_.skip_blocks(nblocks);
+        std::mutex mtx;
+        ouchi::thread::parallel_for_chunk(pool, size_t{ 0 }, nblocks, [&, src, dest, nblocks](size_t b, size_t e) {
+            auto device = base;
+            device.begin_chunk(b);
+            f(device, src + b * Algorithm::block_size, dest + b * Algorithm::block_size, e - b);
+            std::lock_guard lock(mtx);
+            cipher_device_.merge_chunk(device, nblocks - e);
+        });
+    }
+    // bytes kept at the end of the cipher text until decrypt_finalize : the padded block, or the tag
+    static constexpr size_t held_back_size = [] {
+        if constexpr (is_authenticated) return CipherMode<Algorithm>::tag_size;
+        else return size_t{ 1 };
+    }();
+    static constexpr size_t stream_chunk_size = 64 * 1024;
+
+    // processes the whole blocks of pending_ + src except the last keep bytes, and keeps the rest in pending_
+    template<class F>
+    size_t feed(const void* src, size_t size, void* dest, size_t dest_size, size_t keep, F process)
+    {
+        constexpr auto bs = Algorithm::block_size;
+        auto in = static_cast<const std::uint8_t*>(src);
+        auto out = static_cast<std::uint8_t*>(dest);
+        auto total = pending_size_ + size;
+        auto out_size = total > keep ? (total - keep) / bs * bs : 0;
+        if (dest_size < out_size) throw std::out_of_range("dest is too short");
+
+        size_t written = 0;
+        while (written < out_size && pending_size_) {
+            if (pending_size_ < bs) {
+                auto take = bs - pending_size_;
+                std::memcpy(pending_ + pending_size_, in, take);
+                in += take, size -= take, pending_size_ = bs;
+            }
+            process(pending_, out + written, 1);
+            written += bs;
+            pending_size_ -= bs;
+            std::memmove(pending_, pending_ + bs, pending_size_);
+        }
+        auto nblocks = (out_size - written) / bs;
+        process(in, out + written, nblocks);
+        in += nblocks * bs, size -= nblocks * bs, written += nblocks * bs;
+        std::memcpy(pending_ + pending_size_, in, size);
+        pending_size_ += size;
+        return written;
+    }
+    template<class Update, class Finalize>
+    void process_stream(std::istream& is, std::ostream& os, Update update, Finalize finalize)
+    {
+        std::vector<std::uint8_t> in(stream_chunk_size), out(stream_chunk_size + 2 * Algorithm::block_size);
+        do {
+            is.read(reinterpret_cast<char*>(in.data()), in.size());
+            auto n = (this->*update)(in.data(), (size_t)is.gcount(), out.data(), out.size());
+            os.write(reinterpret_cast<char*>(out.data()), n);
+        } while (is);
+        auto n = (this->*finalize)(out.data(), out.size());
+        os.write(reinterpret_cast<char*>(out.data()), n);
+    }
+
     CipherMode<Algorithm> cipher_device_;
+    std::uint8_t pending_[Algorithm::block_size + held_back_size];  // text not processed yet
+    size_t pending_size_ = 0;
+    bool tagged_ = false;  // authenticated modes only
 };
 
 }
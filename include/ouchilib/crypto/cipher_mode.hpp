@@ -1,6 +1,8 @@
 ﻿#pragma once
 #include <type_traits>
 #include <utility>
+#include <cstring>
+#include <algorithm>
 
 #include "common.hpp"
 
@@ -19,6 +21,42 @@ struct is_crypto_algorithm<T,
 >
     : std::true_type {};
 
+// modes producing a tag, which take the text without padding
+template<class T, class = void>
+struct is_authenticated_mode : std::false_type {};
+
+template<class T>
+struct is_authenticated_mode<T, std::void_t<decltype(T::tag_size)>> : std::true_type {};
+
+namespace detail {
+// blocks handed to the algorithm at once by the modes that have to prepare them
+inline constexpr size_t blocks_in_flight = 8;
+
+// A::encrypt_blocks if the algorithm has one, block by block otherwise
+template<class A>
+void encrypt_blocks(A& a, const void* src, void* dest, size_t nblocks)
+{
+    if constexpr (requires { a.encrypt_blocks(src, dest, nblocks); }) {
+        a.encrypt_blocks(src, dest, nblocks);
+    } else {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        for (size_t i = 0; i < nblocks; ++i) a.encrypt(in + i * A::block_size, out + i * A::block_size);
+    }
+}
+template<class A>
+void decrypt_blocks(A& a, const void* src, void* dest, size_t nblocks)
+{
+    if constexpr (requires { a.decrypt_blocks(src, dest, nblocks); }) {
+        a.decrypt_blocks(src, dest, nblocks);
+    } else {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        for (size_t i = 0; i < nblocks; ++i) a.decrypt(in + i * A::block_size, out + i * A::block_size);
+    }
+}
+} // namespace detail
+
 
 template<class A>
 struct ecb {
@@ -42,6 +80,15 @@ struct ecb {
     {
         encoder.decrypt(src, dest);
     }
+    // nblocks consecutive blocks. src and dest may be the same.
+    void encrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        detail::encrypt_blocks(encoder, src, dest, nblocks);
+    }
+    void decrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        detail::decrypt_blocks(encoder, src, dest, nblocks);
+    }
     void set_encrypt_state(memory_iterator<block_size> first, memory_iterator<block_size> just_before) {}
     void set_decrypt_state(memory_iterator<block_size> first, memory_iterator<block_size> just_before) {}
 };
@@ -75,13 +122,59 @@ struct cbc {
         add_assign<block_size>(dest, vector);
         vector = src;
     }
+    // encryption is serial in cbc
+    void encrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        for (size_t i = 0; i < nblocks; ++i) encrypt(in + i * block_size, out + i * block_size);
+    }
+    // every block is decrypted independently, then chained with the previous cipher text
+    void decrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        // cipher text is kept aside because dest may overwrite it
+        std::uint8_t saved[detail::blocks_in_flight * block_size];
+        while (nblocks) {
+            auto n = std::min(nblocks, detail::blocks_in_flight);
+            std::memcpy(saved, in, n * block_size);
+            detail::decrypt_blocks(encoder, saved, out, n);
+            add_assign<block_size>(out, vector);
+            for (size_t i = 1; i < n; ++i) add_assign<block_size>(out + i * block_size, saved + (i - 1) * block_size);
+            vector = memory_view<block_size>(saved + (n - 1) * block_size);
+            in += n * block_size, out += n * block_size, nblocks -= n;
+        }
+    }
     void set_decrypt_state(memory_iterator<block_size> first, memory_iterator<block_size> just_before)
     {
         vector = *just_before;
     }
 };
 
-template<class A>
+// counter policies of ctr. make<BlockSize>(nonce, counter, block) writes the input block for a counter.
+
+// xors the counter into the first bytes of the nonce, little endian. same as memory_view(nonce) ^ counter.
+struct nonce_xor_counter {
+    template<size_t BlockSize>
+    static void make(const std::uint8_t* nonce, size_t counter, std::uint8_t* block) noexcept
+    {
+        std::memcpy(block, nonce, BlockSize);
+        for (size_t b = 0; b < std::min(sizeof counter, BlockSize); ++b, counter >>= 8) block[b] ^= static_cast<std::uint8_t>(counter);
+    }
+};
+// adds the counter to the last 8 bytes of the nonce as a big endian integer, as in sp 800-38a
+struct nonce_add_counter {
+    template<size_t BlockSize>
+    static void make(const std::uint8_t* nonce, size_t counter, std::uint8_t* block) noexcept
+    {
+        static_assert(BlockSize >= 8);
+        std::memcpy(block, nonce, BlockSize - 8);
+        detail::unpack(detail::pack<std::uint64_t>(nonce + BlockSize - 8) + counter, block + BlockSize - 8);
+    }
+};
+
+template<class A, class CounterPolicy = nonce_xor_counter>
 struct ctr {
     using block_t = typename A::block_t;
     static constexpr size_t block_size = A::block_size;
@@ -97,6 +190,7 @@ struct ctr {
         : encoder{ std::forward<Args>(args)... }
         , nonce{ init_nonce }
         , counter{ init_ctr }
+        , origin_{ init_ctr }
     {}
     ~ctr()
     {
@@ -104,31 +198,78 @@ struct ctr {
     }
     void encrypt(block_t src, void* dest)
     {
-        memory_entity<block_size> buf;
-        encoder.encrypt(memory_view<block_size>(nonce) ^ counter, buf.data);
-        add<block_size>(buf, src, dest);
-        update_counter();
+        encrypt_blocks(src.data, dest, 1);
     }
     void decrypt(block_t src, void* dest)
     {
         encrypt(src, dest);
     }
-    virtual void update_counter()
+    // the key stream of up to 8 blocks is encrypted at once
+    void encrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        std::uint8_t stream[detail::blocks_in_flight * block_size];
+        while (nblocks) {
+            auto n = std::min(nblocks, detail::blocks_in_flight);
+            make_keystream(counter, n, stream);
+            counter += n;
+            for (size_t i = 0; i < n * block_size; ++i) out[i] = in[i] ^ stream[i];
+            in += n * block_size, out += n * block_size, nblocks -= n;
+        }
+    }
+    void decrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        encrypt_blocks(src, dest, nblocks);
+    }
+    // the key stream of the blocks [block_index, block_index + nblocks) of the text.
+    // depends neither on the current counter nor on the preceding blocks.
+    void keystream_at(size_t block_index, size_t nblocks, void* dest) const
+    {
+        make_keystream(origin_ + block_index, nblocks, static_cast<std::uint8_t*>(dest));
+    }
+    // en/decrypts size bytes from the byte offset of the text. only the blocks covering them are computed.
+    void crypt_at(size_t offset, const void* src, void* dest, size_t size) const
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        std::uint8_t stream[detail::blocks_in_flight * block_size];
+        auto index = offset / block_size;
+        auto skip = offset % block_size;
+        while (size) {
+            auto n = std::min((skip + size + block_size - 1) / block_size, detail::blocks_in_flight);
+            keystream_at(index, n, stream);
+            auto len = std::min(size, n * block_size - skip);
+            for (size_t i = 0; i < len; ++i) out[i] = in[i] ^ stream[skip + i];
+            in += len, out += len, size -= len, index += n, skip = 0;
+        }
+    }
+    void update_counter()
     {
         ++counter;
     }
-    virtual void update_counter(size_t current_cnt)
+    void update_counter(size_t current_cnt)
     {
         counter = current_cnt;
     }
+    // the counter of the block after just_before, counted from the current one
     void set_decrypt_state(memory_iterator<block_size> first, memory_iterator<block_size> just_before)
     {
-        update_counter(first.count() - just_before.count());
+        update_counter(counter + (first.count() - just_before.count()));
         update_counter();
     }
     void set_encrypt_state(memory_iterator<block_size> first, memory_iterator<block_size> just_before)
     {
         set_decrypt_state(first, just_before);
     }
+private:
+    size_t origin_;  // counter of the first block
+
+    void make_keystream(size_t first_counter, size_t nblocks, std::uint8_t* dest) const
+    {
+        for (size_t i = 0; i < nblocks; ++i)
+            CounterPolicy::template make<block_size>(nonce.data, first_counter + i, dest + i * block_size);
+        detail::encrypt_blocks(encoder, dest, dest, nblocks);
+    }
 };
 } // namespace ouchi::crypto
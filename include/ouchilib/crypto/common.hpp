@@ -9,6 +9,12 @@
 #include "ouchilib/utl/multiitr.hpp"
 #include "ouchilib/utl/constexpr_for.h"
 
+// x86 and x64, the only targets of the simd paths and cpu_features.
+// elsewhere only the portable implementations are built.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#   define OUCHI_CRYPTO_X86 1
+#endif
+
 namespace ouchi::crypto {
 
 template<class T>
@@ -0,0 +1,101 @@
+﻿#pragma once
+#include <cstdint>
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#   include <immintrin.h>
+#else
+#   include <cpuid.h>
+#endif
+
+// functions using instructions beyond the baseline of the translation unit.
+// msvc compiles every intrinsic anyway, gcc and clang need the target named.
+#if defined(_MSC_VER) && !defined(__clang__)
+#   define OUCHI_TARGET(features)
+#else
+#   define OUCHI_TARGET(features) __attribute__((target(features)))
+#endif
+
+// code shared by functions of several targets. inlined into each, where it gets the target of the caller.
+#if defined(_MSC_VER) && !defined(__clang__)
+#   define OUCHI_FORCEINLINE __forceinline
+#else
+#   define OUCHI_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+namespace ouchi::crypto {
+
+// instruction set extensions usable on this cpu and os. detected once.
+struct cpu_features {
+    bool aes = false;
+    bool pclmul = false;
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool avx2 = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool avx512vl = false;
+    bool vaes = false;
+    bool vpclmul = false;
+    bool sha = false;
+
+    static const cpu_features& get() noexcept
+    {
+        static const cpu_features f = detect();
+        return f;
+    }
+private:
+    static void cpuid(std::uint32_t leaf, std::uint32_t sub, std::uint32_t (&r)[4]) noexcept
+    {
+#if defined(_MSC_VER)
+        int regs[4];
+        __cpuidex(regs, (int)leaf, (int)sub);
+        for (int i = 0; i < 4; ++i) r[i] = (std::uint32_t)regs[i];
+#else
+        r[0] = r[1] = r[2] = r[3] = 0;
+        __get_cpuid_count(leaf, sub, &r[0], &r[1], &r[2], &r[3]);
+#endif
+    }
+    // register state the os saves on context switches
+    static std::uint64_t xcr0() noexcept
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        std::uint32_t eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        return ((std::uint64_t)edx << 32) | eax;
+#endif
+    }
+    static cpu_features detect() noexcept
+    {
+        cpu_features f;
+        std::uint32_t r[4];
+        cpuid(0, 0, r);
+        auto max_leaf = r[0];
+        if (max_leaf < 1) return f;
+        cpuid(1, 0, r);
+        auto bit = [](std::uint32_t reg, int i) { return ((reg >> i) & 1) != 0; };
+        f.ssse3 = bit(r[2], 9);
+        f.sse41 = bit(r[2], 19);
+        f.pclmul = bit(r[2], 1);
+        f.aes = bit(r[2], 25);
+        bool osxsave = bit(r[2], 27);
+        bool avx = bit(r[2], 28);
+        std::uint64_t xcr = osxsave ? xcr0() : 0;
+        bool ymm = avx && (xcr & 0x6) == 0x6;
+        bool zmm = ymm && (xcr & 0xe0) == 0xe0;
+        if (max_leaf < 7) return f;
+        cpuid(7, 0, r);
+        f.avx2 = ymm && bit(r[1], 5);
+        f.avx512f = zmm && bit(r[1], 16);
+        f.avx512bw = zmm && bit(r[1], 30);
+        f.avx512vl = zmm && bit(r[1], 31);
+        f.sha = bit(r[1], 29);
+        // the wide forms need the matching register state
+        f.vaes = ymm && bit(r[2], 9);
+        f.vpclmul = ymm && bit(r[2], 10);
+        return f;
+    }
+};
+
+}
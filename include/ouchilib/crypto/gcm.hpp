@@ -0,0 +1,179 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <utility>
+#include "cipher_mode.hpp"
+#include "ghash.hpp"
+
+namespace ouchi::crypto {
+
+/// <summary>
+/// galois/counter mode. ctr encryption from a 96 bit iv, authenticated by ghash over the aad and the cipher text.
+/// an iv must never be used twice with the same key.
+/// block_encoder adds no padding and appends the tag_size byte tag to the cipher text.
+/// </summary>
+template<class A>
+struct gcm {
+    static_assert(A::block_size == 16, "gcm needs a 128 bit block cipher");
+    using block_t = typename A::block_t;
+    static constexpr size_t block_size = A::block_size;
+    static constexpr size_t iv_size = 12;
+    static constexpr size_t tag_size = 16;
+    static constexpr bool is_encrypt_parallelizable = true;
+    static constexpr bool is_decrypt_parallelizable = true;
+
+    A encoder;
+
+    template<class ...Args>
+    gcm(std::in_place_t, memory_view<iv_size> iv, Args&& ...args)
+        : encoder{ std::forward<Args>(args)... }
+        , hash_{ hash_key(encoder) }
+    {
+        std::memcpy(iv_, iv.data, iv_size);
+    }
+    ~gcm()
+    {
+        secure_memset(iv_, 0);
+    }
+
+    // additional authenticated data. call at most once, before any text.
+    void set_aad(const void* aad, size_t size)
+    {
+        assert(aad_size_ == 0 && text_size_ == 0);
+        auto* p = static_cast<const std::uint8_t*>(aad);
+        hash_.update(p, size / block_size);
+        if (size % block_size) hash_.update_partial(p + size / block_size * block_size, size % block_size);
+        aad_size_ = size;
+    }
+    void encrypt(block_t src, void* dest)
+    {
+        encrypt_blocks(src.data, dest, 1);
+    }
+    void decrypt(block_t src, void* dest)
+    {
+        decrypt_blocks(src.data, dest, 1);
+    }
+    // blocks_per_pass blocks of key stream are encrypted and then hashed while they are still in l1.
+    // src and dest may be the same.
+    void encrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        text_size_ += nblocks * block_size;
+        while (nblocks) {
+            auto n = std::min(nblocks, blocks_per_pass);
+            crypt(in, out, n);
+            hash_.update(out, n);
+            in += n * block_size, out += n * block_size, nblocks -= n;
+        }
+    }
+    void decrypt_blocks(const void* src, void* dest, size_t nblocks)
+    {
+        auto* in = static_cast<const std::uint8_t*>(src);
+        auto* out = static_cast<std::uint8_t*>(dest);
+        text_size_ += nblocks * block_size;
+        while (nblocks) {
+            auto n = std::min(nblocks, blocks_per_pass);
+            hash_.update(in, n);
+            crypt(in, out, n);
+            in += n * block_size, out += n * block_size, nblocks -= n;
+        }
+    }
+    // the last size (< block_size) bytes of the text. nothing may follow.
+    void encrypt_tail(const void* src, void* dest, size_t size)
+    {
+        if (size == 0) return;
+        crypt_partial(src, dest, size);
+        hash_.update_partial(dest, size);
+        text_size_ += size;
+    }
+    void decrypt_tail(const void* src, void* dest, size_t size)
+    {
+        if (size == 0) return;
+        hash_.update_partial(src, size);
+        crypt_partial(src, dest, size);
+        text_size_ += size;
+    }
+    // the tag over everything passed so far
+    void get_tag(void* dest) const
+    {
+        std::uint8_t lengths[block_size];
+        detail::unpack(static_cast<std::uint64_t>(aad_size_) * 8, lengths);
+        detail::unpack(static_cast<std::uint64_t>(text_size_) * 8, lengths + 8);
+        auto s = hash_;
+        s.update(lengths, 1);
+        memory_entity<block_size> j0, mask;
+        make_counter_block(1, j0.data);
+        encoder.encrypt(j0, mask.data);
+        s.digest(dest);
+        add_assign<block_size>(dest, mask);
+    }
+    // compares in constant time
+    bool verify_tag(const void* tag) const
+    {
+        std::uint8_t expected[tag_size];
+        get_tag(expected);
+        auto* p = static_cast<const std::uint8_t*>(tag);
+        std::uint8_t diff = 0;
+        for (size_t i = 0; i < tag_size; ++i) diff |= expected[i] ^ p[i];
+        return diff == 0;
+    }
+
+    // parallel processing. a copy of the device starts a chunk at block index of the run,
+    // and the device itself skips the run and merges the chunks afterwards in any order.
+    void begin_chunk(size_t index) noexcept
+    {
+        counter_ += static_cast<std::uint32_t>(index);
+        hash_.clear();
+    }
+    void skip_blocks(size_t nblocks) noexcept
+    {
+        counter_ += static_cast<std::uint32_t>(nblocks);
+        text_size_ += nblocks * block_size;
+        hash_.shift(nblocks);
+    }
+    // blocks_after is the number of blocks of the run behind the chunk
+    void merge_chunk(const gcm& chunk, size_t blocks_after) noexcept
+    {
+        hash_.merge(chunk.hash_, blocks_after);
+    }
+private:
+    // enough for one pass of the widest aes_vaes kernel
+    static constexpr size_t blocks_per_pass = 16;
+
+    std::uint8_t iv_[iv_size];
+    std::uint32_t counter_ = 2;  // 1 is for the tag
+    ghash hash_;
+    size_t aad_size_ = 0;
+    size_t text_size_ = 0;
+
+    static memory_entity<block_size> hash_key(const A& a)
+    {
+        memory_entity<block_size> zero{}, h;
+        a.encrypt(zero, h.data);
+        return h;
+    }
+    void make_counter_block(std::uint32_t counter, std::uint8_t* block) const noexcept
+    {
+        std::memcpy(block, iv_, iv_size);
+        detail::unpack(counter, block + iv_size);
+    }
+    void crypt(const std::uint8_t* in, std::uint8_t* out, size_t nblocks)
+    {
+        std::uint8_t stream[blocks_per_pass * block_size];
+        for (size_t i = 0; i < nblocks; ++i) make_counter_block(counter_++, stream + i * block_size);
+        detail::encrypt_blocks(encoder, stream, stream, nblocks);
+        for (size_t i = 0; i < nblocks * block_size; ++i) out[i] = in[i] ^ stream[i];
+    }
+    void crypt_partial(const void* src, void* dest, size_t size)
+    {
+        std::uint8_t block[block_size] = {};
+        std::memcpy(block, src, size);
+        crypt(block, block, 1);
+        std::memcpy(dest, block, size);
+    }
+};
+
+}
@@ -0,0 +1,297 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include "common.hpp"
+#ifdef OUCHI_CRYPTO_X86
+#   include <immintrin.h>
+#   include "cpu_features.hpp"
+#endif
+
+namespace ouchi::crypto {
+
+namespace detail {
+
+// element of GF(2^128) in the bit order of gcm. hi is bytes 0..7 read big endian.
+struct gf128 {
+    std::uint64_t hi = 0;
+    std::uint64_t lo = 0;
+};
+
+inline gf128 load_gf128(const void* src) noexcept
+{
+    auto* p = static_cast<const std::uint8_t*>(src);
+    return { pack<std::uint64_t>(p), pack<std::uint64_t>(p + 8) };
+}
+inline void store_gf128(gf128 x, void* dest) noexcept
+{
+    auto* p = static_cast<std::uint8_t*>(dest);
+    unpack(x.hi, p);
+    unpack(x.lo, p + 8);
+}
+
+// bit serial multiplication without branches on the data. slow, used only for powers of h.
+inline constexpr gf128 gf128_mul(gf128 x, gf128 y) noexcept
+{
+    gf128 z, v = y;
+    for (unsigned i = 0; i < 128; ++i) {
+        std::uint64_t m = 0 - ((i < 64 ? x.hi >> (63 - i) : x.lo >> (127 - i)) & 1);
+        z.hi ^= v.hi & m;
+        z.lo ^= v.lo & m;
+        std::uint64_t r = 0 - (v.lo & 1);
+        v.lo = (v.lo >> 1) | (v.hi << 63);
+        v.hi = (v.hi >> 1) ^ (0xe100'0000'0000'0000 & r);
+    }
+    return z;
+}
+
+#ifdef OUCHI_CRYPTO_X86
+// clmul works on byte reversed blocks, in which the product only needs a shift by 1 before the reduction
+OUCHI_TARGET("ssse3")
+inline __m128i ghash_bswap(__m128i x) noexcept
+{
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+// 256 bit product of a and b added to lo, mid and hi without reduction
+OUCHI_TARGET("pclmul")
+inline void clmul_add(__m128i a, __m128i b, __m128i& lo, __m128i& mid, __m128i& hi) noexcept
+{
+    lo = _mm_xor_si128(lo, _mm_clmulepi64_si128(a, b, 0x00));
+    hi = _mm_xor_si128(hi, _mm_clmulepi64_si128(a, b, 0x11));
+    mid = _mm_xor_si128(mid, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x01), _mm_clmulepi64_si128(a, b, 0x10)));
+}
+// reduces the sum of products modulo x^128 + x^7 + x^2 + x + 1.
+// shift and reduction are linear, so a sum of several products is reduced only once.
+OUCHI_TARGET("sse2")
+inline __m128i clmul_reduce(__m128i lo, __m128i mid, __m128i hi) noexcept
+{
+    lo = _mm_xor_si128(lo, _mm_slli_si128(mid, 8));
+    hi = _mm_xor_si128(hi, _mm_srli_si128(mid, 8));
+    // shift the 256 bit value left by 1
+    auto clo = _mm_srli_epi32(lo, 31);
+    auto chi = _mm_srli_epi32(hi, 31);
+    lo = _mm_slli_epi32(lo, 1);
+    hi = _mm_slli_epi32(hi, 1);
+    auto carry = _mm_srli_si128(clo, 12);
+    chi = _mm_slli_si128(chi, 4);
+    clo = _mm_slli_si128(clo, 4);
+    lo = _mm_or_si128(lo, clo);
+    hi = _mm_or_si128(_mm_or_si128(hi, chi), carry);
+    // first phase
+    auto a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(lo, 31), _mm_slli_epi32(lo, 30)), _mm_slli_epi32(lo, 25));
+    auto b = _mm_srli_si128(a, 4);
+    lo = _mm_xor_si128(lo, _mm_slli_si128(a, 12));
+    // second phase
+    auto c = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(lo, 1), _mm_srli_epi32(lo, 2)), _mm_srli_epi32(lo, 7));
+    lo = _mm_xor_si128(lo, _mm_xor_si128(c, b));
+    return _mm_xor_si128(hi, lo);
+}
+#endif
+
+} // namespace detail
+
+/// <summary>
+/// the universal hash of gcm. x = (x ^ block) * h for every 16 byte block.
+/// runs on pclmulqdq with one reduction per 8 blocks, or on 4 bit tables (not constant time) without it.
+/// the tables are the only implementation outside x86.
+/// </summary>
+class ghash {
+public:
+    static constexpr size_t block_size = 16;
+
+    // h is the hash key, the encryption of the zero block
+    explicit ghash(memory_view<block_size> h)
+        : ghash(h, clmul_supported())
+    {}
+    // clmul = false forces the table implementation
+    ghash(memory_view<block_size> h, bool clmul)
+        : h_{ detail::load_gf128(h.data) }
+        , clmul_{ clmul && clmul_supported() }
+    {
+        if (clmul_) init_powers();
+        else init_table();
+    }
+    ghash(const ghash&) = default;
+    ghash& operator=(const ghash&) = default;
+    ~ghash()
+    {
+        secure_memset(h_, 0);
+        secure_memset(x_, 0);
+        secure_memset(hpow_, 0);
+        secure_memset(hl_, 0);
+        secure_memset(hh_, 0);
+    }
+
+    static bool clmul_supported() noexcept
+    {
+#ifdef OUCHI_CRYPTO_X86
+        auto& f = cpu_features::get();
+        return f.pclmul && f.ssse3;
+#else
+        return false;
+#endif
+    }
+    bool uses_clmul() const noexcept { return clmul_; }
+
+    void update(const void* data, size_t nblocks) noexcept
+    {
+        auto* in = static_cast<const std::uint8_t*>(data);
+#ifdef OUCHI_CRYPTO_X86
+        if (clmul_) return update_clmul(in, nblocks);
+#endif
+        for (size_t i = 0; i < nblocks; ++i, in += block_size) {
+            auto c = detail::load_gf128(in);
+            x_ = mul_table({ x_.hi ^ c.hi, x_.lo ^ c.lo });
+        }
+    }
+    // the last size (< block_size) bytes, padded with zero
+    void update_partial(const void* data, size_t size) noexcept
+    {
+        std::uint8_t block[block_size] = {};
+        std::memcpy(block, data, size);
+        update(block, 1);
+    }
+    void clear() noexcept
+    {
+        x_ = {};
+    }
+    // same as nblocks zero blocks, x = x * h^nblocks
+    void shift(size_t nblocks) noexcept
+    {
+        x_ = mul(x_, power(nblocks));
+    }
+    // adds the hash of a run followed by nblocks more blocks, x ^= other.x * h^nblocks.
+    // lets runs of one text be hashed separately from zero and combined afterwards.
+    void merge(const ghash& other, size_t nblocks) noexcept
+    {
+        auto y = mul(other.x_, power(nblocks));
+        x_.hi ^= y.hi;
+        x_.lo ^= y.lo;
+    }
+    void digest(void* dest) const noexcept
+    {
+        detail::store_gf128(x_, dest);
+    }
+private:
+    static constexpr size_t aggregation = 8;
+
+    detail::gf128 h_;
+    detail::gf128 x_;
+    bool clmul_;
+    alignas(16) std::uint8_t hpow_[aggregation][block_size] = {};  // byte reversed h^1..h^8 for clmul
+    std::uint64_t hl_[16] = {}, hh_[16] = {};                       // 4 bit tables otherwise
+
+    detail::gf128 mul(detail::gf128 a, detail::gf128 b) const noexcept
+    {
+#ifdef OUCHI_CRYPTO_X86
+        if (clmul_) return mul_clmul(a, b);
+#endif
+        return detail::gf128_mul(a, b);
+    }
+    detail::gf128 power(size_t n) const noexcept
+    {
+        detail::gf128 r{ 0x8000'0000'0000'0000, 0 };  // 1
+        for (auto b = h_; n; n >>= 1, b = mul(b, b))
+            if (n & 1) r = mul(r, b);
+        return r;
+    }
+
+    void init_powers() noexcept
+    {
+        auto p = h_;
+        for (size_t i = 0; i < aggregation; ++i) {
+            std::uint8_t block[block_size];
+            detail::store_gf128(p, block);
+            for (size_t j = 0; j < block_size; ++j) hpow_[i][j] = block[block_size - 1 - j];
+            p = detail::gf128_mul(p, h_);
+        }
+    }
+#ifdef OUCHI_CRYPTO_X86
+    OUCHI_TARGET("pclmul,ssse3")
+    detail::gf128 mul_clmul(detail::gf128 a, detail::gf128 b) const noexcept
+    {
+        std::uint8_t block[block_size];
+        detail::store_gf128(a, block);
+        auto va = detail::ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)));
+        detail::store_gf128(b, block);
+        auto vb = detail::ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)));
+        auto lo = _mm_setzero_si128(), mid = lo, hi = lo;
+        detail::clmul_add(va, vb, lo, mid, hi);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(block), detail::ghash_bswap(detail::clmul_reduce(lo, mid, hi)));
+        return detail::load_gf128(block);
+    }
+    OUCHI_TARGET("pclmul,ssse3")
+    void update_clmul(const std::uint8_t* in, size_t nblocks) noexcept
+    {
+        auto* hp = reinterpret_cast<const __m128i*>(hpow_);
+        std::uint8_t block[block_size];
+        detail::store_gf128(x_, block);
+        auto x = detail::ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)));
+        // (x ^ c0) * h^8 ^ c1 * h^7 ^ ... ^ c7 * h
+        for (; nblocks >= aggregation; nblocks -= aggregation, in += aggregation * block_size) {
+            auto lo = _mm_setzero_si128(), mid = lo, hi = lo;
+            for (size_t i = 0; i < aggregation; ++i) {
+                auto c = detail::ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i * block_size)));
+                if (i == 0) c = _mm_xor_si128(c, x);
+                detail::clmul_add(c, _mm_load_si128(hp + aggregation - 1 - i), lo, mid, hi);
+            }
+            x = detail::clmul_reduce(lo, mid, hi);
+        }
+        for (; nblocks; --nblocks, in += block_size) {
+            auto c = detail::ghash_bswap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+            auto lo = _mm_setzero_si128(), mid = lo, hi = lo;
+            detail::clmul_add(_mm_xor_si128(c, x), _mm_load_si128(hp), lo, mid, hi);
+            x = detail::clmul_reduce(lo, mid, hi);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(block), detail::ghash_bswap(x));
+        x_ = detail::load_gf128(block);
+    }
+#endif
+
+    // shoup's method. hl_/hh_[i] is the multiple of h by the 4 bit polynomial i
+    void init_table() noexcept
+    {
+        std::uint64_t vh = h_.hi, vl = h_.lo;
+        hl_[8] = vl;
+        hh_[8] = vh;
+        for (size_t i = 4; i > 0; i >>= 1) {
+            std::uint64_t r = 0 - (vl & 1);
+            vl = (vh << 63) | (vl >> 1);
+            vh = (vh >> 1) ^ (0xe100'0000'0000'0000 & r);
+            hl_[i] = vl;
+            hh_[i] = vh;
+        }
+        for (size_t i = 2; i <= 8; i *= 2) {
+            for (size_t j = 1; j < i; ++j) {
+                hh_[i + j] = hh_[i] ^ hh_[j];
+                hl_[i + j] = hl_[i] ^ hl_[j];
+            }
+        }
+    }
+    detail::gf128 mul_table(detail::gf128 x) const noexcept
+    {
+        // reduction of the 4 bits shifted out
+        constexpr std::uint64_t last4[16] = {
+            0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+            0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0 };
+        std::uint8_t in[block_size];
+        detail::store_gf128(x, in);
+        std::uint64_t zh = 0, zl = 0;
+        auto step = [&](unsigned nibble) {
+            unsigned rem = zl & 0xf;
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (last4[rem] << 48);
+            zh ^= hh_[nibble];
+            zl ^= hl_[nibble];
+        };
+        zh = hh_[in[15] & 0xf];
+        zl = hl_[in[15] & 0xf];
+        step(in[15] >> 4);
+        for (int i = 14; i >= 0; --i) {
+            step(in[i] & 0xf);
+            step(in[i] >> 4);
+        }
+        return { zh, zl };
+    }
+};
+
+}
@@ -0,0 +1,157 @@
+﻿#pragma once
+#include <vector>
+#include <string>
+#include <thread>
+#include <fstream>
+#include <algorithm>
+#include <cctype>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "ouchilib/utl/step.hpp"
+
+namespace ouchi::thread {
+
+namespace detail {
+
+// parses linux cpulist format such as "0-3,8,10-11". node lists use the same format
+inline std::vector<unsigned> parse_cpulist(const std::string& list)
+{
+    std::vector<unsigned> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        auto comma = std::min(list.find(',', pos), list.size());
+        auto item = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        if (item.empty() || !std::isdigit((unsigned char)item[0])) continue;
+        auto dash = item.find('-');
+        auto first = (unsigned)std::stoul(item.substr(0, dash));
+        auto last = dash == std::string::npos ? first : (unsigned)std::stoul(item.substr(dash + 1));
+        for (auto c = first; c <= last; ++c) cpus.push_back(c);
+    }
+    return cpus;
+}
+
+} // namespace detail
+
+/// <summary>
+/// pin the calling thread to cpus. returns false if the platform refused.
+/// on windows only the first 64 logical processors (processor group 0) can be used.
+/// </summary>
+inline bool set_current_thread_affinity(const std::vector<unsigned>& cpus)
+{
+    if (cpus.empty()) return false;
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (auto c : cpus) if (c < sizeof(mask) * 8) mask |= DWORD_PTR{ 1 } << c;
+    return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto c : cpus) if (c < CPU_SETSIZE) CPU_SET(c, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+}
+
+// cpus the calling thread may run on
+inline std::vector<unsigned> get_current_thread_affinity()
+{
+    std::vector<unsigned> cpus;
+#if defined(_WIN32)
+    // there is no GetThreadAffinityMask. set the process mask and restore the old thread mask.
+    DWORD_PTR process_mask, system_mask;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) return cpus;
+    auto mask = SetThreadAffinityMask(GetCurrentThread(), process_mask);
+    if (!mask) return cpus;
+    SetThreadAffinityMask(GetCurrentThread(), mask);
+    for (auto c : ouchi::step(sizeof(mask) * 8)) if (mask & (DWORD_PTR{ 1 } << c)) cpus.push_back((unsigned)c);
+#else
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) return cpus;
+    for (unsigned c = 0; c < CPU_SETSIZE; ++c) if (CPU_ISSET(c, &set)) cpus.push_back(c);
+#endif
+    return cpus;
+}
+
+/// <summary>
+/// name the calling thread for debuggers and profilers. returns false if the platform refused.
+/// linux truncates the name to 15 characters.
+/// </summary>
+inline bool set_current_thread_name(const std::string& name)
+{
+#if defined(_WIN32)
+    std::wstring wname(name.begin(), name.end());
+    return SUCCEEDED(SetThreadDescription(GetCurrentThread(), wname.c_str()));
+#elif defined(__APPLE__)
+    return pthread_setname_np(name.substr(0, 63).c_str()) == 0;
+#else
+    return pthread_setname_np(pthread_self(), name.substr(0, 15).c_str()) == 0;
+#endif
+}
+
+/// <summary>
+/// logical processors of each numa node.
+/// a machine without numa information is reported as a single node holding every processor.
+/// </summary>
+inline std::vector<std::vector<unsigned>> numa_nodes()
+{
+    std::vector<std::vector<unsigned>> nodes;
+#if defined(_WIN32)
+    ULONG highest = 0;
+    if (GetNumaHighestNodeNumber(&highest)) {
+        for (auto n : ouchi::step(highest + 1)) {
+            ULONGLONG mask = 0;
+            if (!GetNumaNodeProcessorMask((UCHAR)n, &mask) || !mask) continue;
+            auto& cpus = nodes.emplace_back();
+            for (auto c : ouchi::step(64u)) if (mask & (ULONGLONG{ 1 } << c)) cpus.push_back(c);
+        }
+    }
+#else
+    // node ids may have gaps (node0, node2), so they are taken from the list of online nodes
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string ids;
+    std::getline(online, ids);
+    for (auto n : detail::parse_cpulist(ids)) {
+        std::ifstream f("/sys/devices/system/node/node" + std::to_string(n) + "/cpulist");
+        std::string list;
+        if (!std::getline(f, list)) continue;
+        auto cpus = detail::parse_cpulist(list);
+        if (!cpus.empty()) nodes.push_back(std::move(cpus));
+    }
+#endif
+    if (nodes.empty()) {
+        auto& cpus = nodes.emplace_back();
+        for (auto c : ouchi::step(std::max(std::thread::hardware_concurrency(), 1u))) cpus.push_back(c);
+    }
+    return nodes;
+}
+
+// worker placement of thread_pool
+struct pool_options {
+    size_t thread_count = 2;
+    // workers are named "<name>-<index>". empty : keep the default name
+    std::string name;
+    // worker i is pinned to cpus[i % cpus.size()]. takes precedence over spread_numa_nodes
+    std::vector<unsigned> cpus;
+    // worker i is pinned to every cpu of numa node i % node count
+    bool spread_numa_nodes = false;
+
+    // cpus worker i should be pinned to. empty : no pinning
+    std::vector<unsigned> cpus_of(size_t i, const std::vector<std::vector<unsigned>>& nodes) const
+    {
+        if (!cpus.empty()) return { cpus[i % cpus.size()] };
+        if (spread_numa_nodes && !nodes.empty()) return nodes[i % nodes.size()];
+        return {};
+    }
+};
+
+}
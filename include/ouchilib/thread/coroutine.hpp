@@ -0,0 +1,343 @@
+﻿#pragma once
+#include <coroutine>
+#include <exception>
+#include <stdexcept>
+#include <optional>
+#include <variant>
+#include <tuple>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <utility>
+
+namespace ouchi::thread {
+
+template<class T = void>
+class co_task;
+
+namespace detail {
+
+struct co_promise_base {
+    struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        template<class Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+        {
+            return h.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    final_awaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr exception;
+};
+
+template<class T>
+struct co_promise : co_promise_base {
+    co_task<T> get_return_object() noexcept;
+    template<class U = T>
+    void return_value(U&& value)
+    {
+        this->value.emplace(std::forward<U>(value));
+    }
+    T result()
+    {
+        if (exception) std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+
+    std::optional<T> value;
+};
+
+template<>
+struct co_promise<void> : co_promise_base {
+    co_task<void> get_return_object() noexcept;
+    void return_void() noexcept {}
+    void result()
+    {
+        if (exception) std::rethrow_exception(exception);
+    }
+};
+
+} // namespace detail
+
+/// <summary>
+/// lazily started coroutine returning T.
+/// the body starts when the task is awaited and the awaiter is resumed on the thread that finishes it.
+/// use schedule() inside the body to move to a thread_pool, and sync_wait() to block on it from normal code.
+/// </summary>
+template<class T>
+class [[nodiscard]] co_task {
+public:
+    using promise_type = detail::co_promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    co_task() noexcept = default;
+    explicit co_task(handle_type h) noexcept
+        : h_{ h }
+    {}
+    co_task(co_task&& other) noexcept
+        : h_{ std::exchange(other.h_, {}) }
+    {}
+    co_task& operator=(co_task&& other) noexcept
+    {
+        if (this != &other) {
+            if (h_) h_.destroy();
+            h_ = std::exchange(other.h_, {});
+        }
+        return *this;
+    }
+    ~co_task()
+    {
+        if (h_) h_.destroy();
+    }
+
+    bool done() const noexcept { return !h_ || h_.done(); }
+
+    // start the body and get its result, or rethrow its exception. awaited at most once.
+    // awaiting an empty task throws std::logic_error
+    auto operator co_await() noexcept
+    {
+        struct awaiter {
+            handle_type h;
+            bool await_ready() noexcept { return !h || h.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> waiter) noexcept
+            {
+                h.promise().continuation = waiter;
+                return h;
+            }
+            T await_resume()
+            {
+                if (!h) throw std::logic_error("co_task: awaiting an empty task");
+                return h.promise().result();
+            }
+        };
+        return awaiter{ h_ };
+    }
+private:
+    handle_type h_;
+};
+
+namespace detail {
+
+template<class T>
+co_task<T> co_promise<T>::get_return_object() noexcept
+{
+    return co_task<T>{ std::coroutine_handle<co_promise<T>>::from_promise(*this) };
+}
+inline co_task<void> co_promise<void>::get_return_object() noexcept
+{
+    return co_task<void>{ std::coroutine_handle<co_promise<void>>::from_promise(*this) };
+}
+
+template<class T>
+using co_result_t = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+// awaits one task and reports to Completion when it is done.
+// Completion::arrive() decides what runs next.
+template<class Completion>
+class completion_driver {
+public:
+    struct promise_type {
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            auto await_suspend(std::coroutine_handle<promise_type> h) noexcept
+            {
+                return h.promise().completion->arrive();
+            }
+            void await_resume() noexcept {}
+        };
+        completion_driver get_return_object() noexcept
+        {
+            return completion_driver{ std::coroutine_handle<promise_type>::from_promise(*this) };
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        final_awaiter final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        // the driver body catches everything
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        Completion* completion = nullptr;
+    };
+
+    completion_driver(completion_driver&& other) noexcept
+        : h_{ std::exchange(other.h_, {}) }
+    {}
+    ~completion_driver()
+    {
+        if (h_) h_.destroy();
+    }
+    void start(Completion& c) noexcept
+    {
+        h_.promise().completion = &c;
+        h_.resume();
+    }
+private:
+    explicit completion_driver(std::coroutine_handle<promise_type> h) noexcept
+        : h_{ h }
+    {}
+    std::coroutine_handle<promise_type> h_;
+};
+
+template<class Completion, class T>
+completion_driver<Completion> drive(co_task<T>& task, std::optional<co_result_t<T>>& out, std::exception_ptr& error)
+{
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await task;
+            out.emplace();
+        } else {
+            out.emplace(co_await task);
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+}
+
+// resumes the awaiting coroutine when the last of count tasks finished
+class when_all_counter {
+public:
+    explicit when_all_counter(size_t count) noexcept
+        : count_{ count + 1 }
+    {}
+    std::coroutine_handle<> arrive() noexcept
+    {
+        if (count_.fetch_sub(1, std::memory_order_acq_rel) == 1) return waiter_;
+        return std::noop_coroutine();
+    }
+    // start is called from await_suspend after the waiter is registered
+    template<class Start>
+    auto wait(Start start) noexcept
+    {
+        struct awaiter {
+            when_all_counter& counter;
+            Start start;
+            bool await_ready() noexcept { return false; }
+            bool await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                counter.waiter_ = h;
+                start();
+                // suspend unless every task finished inline
+                return counter.count_.fetch_sub(1, std::memory_order_acq_rel) != 1;
+            }
+            void await_resume() noexcept {}
+        };
+        return awaiter{ *this, std::move(start) };
+    }
+private:
+    std::atomic_size_t count_;
+    std::coroutine_handle<> waiter_;
+};
+
+// wakes a thread blocked in sync_wait
+class sync_wait_event {
+public:
+    // returns void so that nothing touches the driver frame after the waiter may have destroyed it
+    void arrive() noexcept
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        done_ = true;
+        cv_.notify_all();
+    }
+    void wait()
+    {
+        std::unique_lock<std::mutex> ul(mtx_);
+        cv_.wait(ul, [this]() { return done_; });
+    }
+private:
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    bool done_ = false;
+};
+
+} // namespace detail
+
+/// <summary>
+/// co_await schedule(pool) resumes the coroutine on a worker of pool.
+/// Pool is any basic_thread_pool.
+/// </summary>
+template<class Pool>
+auto schedule(Pool& pool) noexcept
+{
+    struct awaiter {
+        Pool& pool;
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) { pool.push([h]() { h.resume(); }); }
+        void await_resume() noexcept {}
+    };
+    return awaiter{ pool };
+}
+
+/// <summary>
+/// block the calling thread until task finishes and return its result.
+/// the task runs on the calling thread until it reaches its first schedule().
+/// </summary>
+template<class T>
+T sync_wait(co_task<T> task)
+{
+    detail::sync_wait_event event;
+    std::optional<detail::co_result_t<T>> result;
+    std::exception_ptr error;
+    {
+        auto driver = detail::drive<detail::sync_wait_event>(task, result, error);
+        driver.start(event);
+        event.wait();
+    }
+    if (error) std::rethrow_exception(error);
+    if constexpr (!std::is_void_v<T>) return std::move(*result);
+}
+
+/// <summary>
+/// start every task and finish when all of them are done.
+/// results are returned in argument order. a void task yields std::monostate.
+/// if some tasks throw, the exception of the first of them in argument order is rethrown after all finished.
+/// </summary>
+template<class ...Ts>
+co_task<std::tuple<detail::co_result_t<Ts>...>> when_all(co_task<Ts> ...tasks)
+{
+    constexpr auto n = sizeof...(Ts);
+    std::tuple<std::optional<detail::co_result_t<Ts>>...> results;
+    std::array<std::exception_ptr, n> errors;
+    // drivers must live in this frame until the counter resumes it
+    std::vector<detail::completion_driver<detail::when_all_counter>> drivers;
+    drivers.reserve(n);
+    [&]<size_t ...I>(std::index_sequence<I...>) {
+        (drivers.push_back(detail::drive<detail::when_all_counter>(tasks, std::get<I>(results), errors[I])), ...);
+    }(std::index_sequence_for<Ts...>{});
+    detail::when_all_counter counter(n);
+    co_await counter.wait([&]() { for (auto& d : drivers) d.start(counter); });
+    for (auto& e : errors) if (e) std::rethrow_exception(e);
+    co_return std::apply([](auto& ...r) { return std::tuple<detail::co_result_t<Ts>...>(std::move(*r)...); }, results);
+}
+
+// results in the order of tasks. co_task<void> if T is void
+template<class T>
+auto when_all(std::vector<co_task<T>> tasks)
+    -> co_task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>>
+{
+    auto n = tasks.size();
+    std::vector<std::optional<detail::co_result_t<T>>> results(n);
+    std::vector<std::exception_ptr> errors(n);
+    std::vector<detail::completion_driver<detail::when_all_counter>> drivers;
+    drivers.reserve(n);
+    for (size_t i = 0; i < n; ++i)
+        drivers.push_back(detail::drive<detail::when_all_counter>(tasks[i], results[i], errors[i]));
+    detail::when_all_counter counter(n);
+    co_await counter.wait([&]() { for (auto& d : drivers) d.start(counter); });
+    for (auto& e : errors) if (e) std::rethrow_exception(e);
+    if constexpr (!std::is_void_v<T>) {
+        std::vector<T> values;
+        values.reserve(n);
+        for (auto& r : results) values.push_back(std::move(*r));
+        co_return values;
+    }
+}
+
+}
@@ -0,0 +1,210 @@
+﻿#pragma once
+#include <atomic>
+#include <memory>
+#include <new>
+#include <thread>
+#include <stdexcept>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <bit>
+#include <cstddef>
+#include <algorithm>
+
+namespace ouchi::thread {
+
+// what push() does when the queue is full
+enum class overflow_policy {
+    block,  // wait until a consumer makes room
+    drop,   // discard the new element and count it in dropped()
+    fail,   // throw queue_full
+};
+
+class queue_full : public std::runtime_error {
+public:
+    queue_full()
+        : std::runtime_error("mpmc_queue: queue is full")
+    {}
+};
+
+/// <summary>
+/// bounded lock free multi producer multi consumer queue (dmitry vyukov's sequenced ring buffer).
+/// every slot carries a sequence number telling whether it is ready for the producer or the consumer of a lap,
+/// so producers and consumers only contend on their own index.
+/// capacity is rounded up to a power of two.
+/// </summary>
+template<class T>
+class mpmc_queue {
+    static_assert(std::is_nothrow_destructible_v<T>);
+public:
+    explicit mpmc_queue(size_t capacity, overflow_policy policy = overflow_policy::block)
+        : mask_{ std::bit_ceil(std::max<size_t>(capacity, 2)) - 1 }
+        , cells_{ std::make_unique<cell[]>(mask_ + 1) }
+        , policy_{ policy }
+    {
+        for (size_t i = 0; i <= mask_; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    mpmc_queue(const mpmc_queue&) = delete;
+    ~mpmc_queue()
+    {
+        while (consume([](T&&) noexcept {}));
+    }
+
+    /// <summary>
+    /// construct an element in place. returns false if the queue is full.
+    /// a constructor that may throw runs on a temporary before a slot is claimed, which is then moved in
+    /// (T must be nothrow move constructible then), so that a throw never leaves a claimed slot unpublished.
+    /// in that case rvalue arguments are consumed even if false is returned.
+    /// </summary>
+    template<class ...Args>
+    bool try_emplace(Args&& ...args)
+    {
+        if constexpr (std::is_nothrow_constructible_v<T, Args&&...>) {
+            auto* c = claim();
+            if (!c) return false;
+            ::new(static_cast<void*>(c->storage)) T(std::forward<Args>(args)...);
+            publish(c);
+            return true;
+        } else {
+            static_assert(std::is_nothrow_move_constructible_v<T>,
+                          "mpmc_queue: T must be nothrow move constructible if its constructor may throw");
+            T tmp(std::forward<Args>(args)...);
+            return try_emplace(std::move(tmp));
+        }
+    }
+    bool try_push(const T& value) { return try_emplace(value); }
+    bool try_push(T&& value) { return try_emplace(std::move(value)); }
+
+    // returns false if value was dropped. see overflow_policy
+    template<class U>
+    bool push(U&& value)
+    {
+        if constexpr (!std::is_nothrow_constructible_v<T, U&&>) {
+            // built once, not on every retry
+            static_assert(std::is_nothrow_move_constructible_v<T>,
+                          "mpmc_queue: T must be nothrow move constructible if its constructor may throw");
+            return push(T(std::forward<U>(value)));
+        }
+        for (unsigned spin = 0; !try_emplace(std::forward<U>(value)); ++spin) {
+            switch (policy_) {
+            case overflow_policy::drop:
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case overflow_policy::fail:
+                throw queue_full{};
+            case overflow_policy::block:
+                backoff(spin);
+                break;
+            }
+        }
+        return true;
+    }
+
+    // returns false if the queue is empty
+    bool try_pop(T& out)
+    {
+        return consume([&out](T&& v) { out = std::move(v); });
+    }
+    std::optional<T> try_pop()
+    {
+        std::optional<T> r;
+        consume([&r](T&& v) { r.emplace(std::move(v)); });
+        return r;
+    }
+    // wait until an element is available
+    T pop()
+    {
+        std::optional<T> r;
+        for (unsigned spin = 0; !(r = try_pop()); ++spin) backoff(spin);
+        return std::move(*r);
+    }
+
+    size_t capacity() const noexcept { return mask_ + 1; }
+    // approximate while other threads are pushing or popping
+    size_t size() const noexcept
+    {
+        auto d = dequeue_pos_.load(std::memory_order_relaxed);
+        auto e = enqueue_pos_.load(std::memory_order_relaxed);
+        return e > d ? std::min<size_t>(e - d, capacity()) : 0;
+    }
+    bool empty() const noexcept { return size() == 0; }
+    size_t dropped() const noexcept { return dropped_.load(std::memory_order_relaxed); }
+    overflow_policy policy() const noexcept { return policy_; }
+private:
+    struct cell {
+        std::atomic_size_t seq;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+    static void backoff(unsigned spin) noexcept
+    {
+        // no blocking primitive is used, so that the fast path never enters the kernel
+        if (spin >= 64) std::this_thread::yield();
+    }
+    // the slot of the next element, or nullptr if the queue is full
+    cell* claim() noexcept
+    {
+        auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            auto* c = &cells_[pos & mask_];
+            auto seq = c->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) return c;
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+    // hands a claimed slot holding its element to the consumers
+    static void publish(cell* c) noexcept
+    {
+        // a claimed slot still has the sequence number of its position
+        c->seq.store(c->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+    // passes the front element to f as an rvalue. the slot is released even if f throws
+    template<class F>
+    bool consume(F&& f)
+    {
+        auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+        cell* c;
+        while (true) {
+            c = &cells_[pos & mask_];
+            auto seq = c->seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        auto* p = std::launder(reinterpret_cast<T*>(c->storage));
+        struct release {
+            T* p;
+            cell* c;
+            size_t next;
+            ~release()
+            {
+                p->~T();
+                // ready for the producer of the next lap
+                c->seq.store(next, std::memory_order_release);
+            }
+        } r{ p, c, pos + mask_ + 1 };
+        f(std::move(*p));
+        return true;
+    }
+
+    size_t mask_;
+    std::unique_ptr<cell[]> cells_;
+    overflow_policy policy_;
+    std::atomic_size_t dropped_ = 0;
+    // producers and consumers update their index on separate cache lines
+    alignas(64) std::atomic_size_t enqueue_pos_ = 0;
+    alignas(64) std::atomic_size_t dequeue_pos_ = 0;
+    char padding_[64 - sizeof(std::atomic_size_t)];
+};
+
+}
@@ -0,0 +1,142 @@
+﻿#pragma once
+#include <type_traits>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <exception>
+#include <utility>
+#include "ouchilib/utl/step.hpp"
+
+namespace ouchi::thread {
+
+namespace detail {
+
+// [first, last) is cut into chunks of `grain` elements.
+// chunks are handed out one by one from an atomic counter, so fast workers take more of them.
+template<class T>
+struct chunked_range {
+    T first;
+    size_t count;
+    size_t grain;
+
+    size_t chunk_count() const noexcept { return (count + grain - 1) / grain; }
+    std::pair<T, T> chunk(size_t i) const
+    {
+        auto b = first + i * grain;
+        return { static_cast<T>(b), static_cast<T>(b + std::min(grain, count - i * grain)) };
+    }
+};
+
+template<class T>
+chunked_range<T> make_chunked_range(T first, T last, size_t grain, size_t worker_count)
+{
+    auto count = static_cast<size_t>(last - first);
+    // about 8 chunks per worker leaves room for balancing without much contention on the counter
+    if (grain == 0) grain = std::max<size_t>(count / (worker_count * 8), 1);
+    return { first, count, grain };
+}
+
+// state of one run_chunks, shared with the helpers so that a helper starting late only sees every chunk taken
+struct chunk_state {
+    std::atomic_size_t next = 0;
+    std::atomic_size_t active = 0;  // loops between claiming a chunk and finishing it
+    std::atomic_flag failed;
+    std::exception_ptr error;       // written by the first failing chunk only
+};
+
+// runs body(chunk index) for every chunk on the pool and the calling thread.
+// the first exception is rethrown after every chunk in flight has finished.
+// the caller waits only for the chunks the helpers actually claimed,
+// so helpers still queued (a paused or busy pool) do not keep it waiting.
+// a worker of pool runs every chunk itself : waiting for helpers queued behind it could deadlock
+// once every worker is waiting like that (nested loops, parallel work pushed to the same pool).
+template<class Pool, class Body>
+void run_chunks(Pool& pool, size_t chunk_count, Body& body)
+{
+    if (chunk_count == 0) return;
+    auto state = std::make_shared<chunk_state>();
+    // body is not touched once every chunk is claimed, so late helpers may outlive it
+    auto loop = [state, body = &body, chunk_count]() {
+        while (true) {
+            // counted before claiming, so that the caller sees the chunk once the claim is visible
+            ++state->active;
+            auto c = state->next++;
+            if (c < chunk_count) {
+                try {
+                    (*body)(c);
+                } catch (...) {
+                    state->next = chunk_count;
+                    if (!state->failed.test_and_set()) state->error = std::current_exception();
+                }
+            }
+            if (--state->active == 0) state->active.notify_all();
+            if (c >= chunk_count) return;
+        }
+    };
+    size_t helper_count = std::min<size_t>(pool.size(), chunk_count - 1);
+    if constexpr (requires { pool.is_worker(); }) {
+        if (pool.is_worker()) helper_count = 0;
+    }
+    for (size_t i = 0; i < helper_count; ++i) pool.push(loop);
+    loop();
+    for (size_t a; (a = state->active) != 0;) state->active.wait(a);
+    if (state->error) std::rethrow_exception(state->error);
+}
+
+} // namespace detail
+
+/// <summary>
+/// calls f(b, e) for every sub range [b, e) of [first, last).
+/// grain is the size of one sub range. 0 picks one from the range size and pool.size().
+/// the calling thread processes chunks too. called from a worker of pool (nested), it processes all of them.
+/// it returns once every chunk is done, even if pool is paused and no helper has started.
+/// </summary>
+template<class Pool, additive T, class F>
+void parallel_for_chunk(Pool& pool, T first, T last, F&& f, size_t grain = 0)
+{
+    static_assert(std::is_invocable_v<F&, T, T>);
+    auto range = detail::make_chunked_range(first, last, grain, pool.size());
+    auto body = [&range, &f](size_t c) {
+        auto [b, e] = range.chunk(c);
+        f(b, e);
+    };
+    detail::run_chunks(pool, range.chunk_count(), body);
+}
+
+/// <summary>
+/// calls f(i) for every i in [first, last).
+/// </summary>
+template<class Pool, additive T, class F>
+void parallel_for(Pool& pool, T first, T last, F&& f, size_t grain = 0)
+{
+    static_assert(std::is_invocable_v<F&, T>);
+    parallel_for_chunk(pool, first, last, [&f](T b, T e) {
+        for (auto i : ouchi::step(b, e)) f(i);
+    }, grain);
+}
+
+/// <summary>
+/// folds [first, last) with f(acc, i) per chunk starting from identity,
+/// then combines the partial results with reduce(a, b) in chunk order.
+/// the result is deterministic as long as reduce is associative.
+/// </summary>
+template<class Pool, additive T, class V, class F, class R>
+V parallel_reduce(Pool& pool, T first, T last, V identity, F&& f, R&& reduce, size_t grain = 0)
+{
+    static_assert(std::is_invocable_r_v<V, F&, V, T>);
+    static_assert(std::is_invocable_r_v<V, R&, V, V>);
+    auto range = detail::make_chunked_range(first, last, grain, pool.size());
+    std::vector<V> partial(range.chunk_count(), identity);
+    auto body = [&range, &f, &partial](size_t c) {
+        auto [b, e] = range.chunk(c);
+        V acc = std::move(partial[c]);
+        for (auto i : ouchi::step(b, e)) acc = f(std::move(acc), i);
+        partial[c] = std::move(acc);
+    };
+    detail::run_chunks(pool, range.chunk_count(), body);
+    for (auto& p : partial) identity = reduce(std::move(identity), std::move(p));
+    return identity;
+}
+
+}
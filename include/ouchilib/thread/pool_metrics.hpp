@@ -0,0 +1,163 @@
+﻿#pragma once
+#include <atomic>
+#include <array>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <bit>
+
+namespace ouchi::thread {
+
+// durations bucketed by powers of two nanoseconds. bucket i holds [2^i, 2^(i+1)) ns, bucket 0 also holds 0.
+struct latency_histogram {
+    static constexpr size_t bucket_count = 40;  // up to about 18 minutes
+    std::array<size_t, bucket_count> buckets{};
+    size_t count = 0;
+    std::chrono::nanoseconds total{ 0 };
+    std::chrono::nanoseconds max{ 0 };
+
+    std::chrono::nanoseconds mean() const noexcept
+    {
+        if (count == 0) return std::chrono::nanoseconds{ 0 };
+        return total / static_cast<std::chrono::nanoseconds::rep>(count);
+    }
+    // upper bound of the bucket holding the p-th quantile (0 <= p <= 1)
+    std::chrono::nanoseconds percentile(double p) const noexcept
+    {
+        auto rank = static_cast<size_t>(p * count);
+        size_t seen = 0;
+        for (size_t i = 0; i < bucket_count; ++i) {
+            seen += buckets[i];
+            if (seen > rank || seen == count)
+                return std::min(std::chrono::nanoseconds{ (long long)(2ull << i) - 1 }, max);
+        }
+        return max;
+    }
+};
+
+struct worker_statistics {
+    std::chrono::nanoseconds busy{ 0 };  // time spent running work
+    std::chrono::nanoseconds idle{ 0 };  // lifetime of the worker minus busy
+    size_t executed = 0;
+    size_t steals = 0;                   // work taken from other workers' queues
+
+    double utilization() const noexcept
+    {
+        auto all = busy + idle;
+        return all.count() ? (double)busy.count() / all.count() : 0.0;
+    }
+};
+
+struct pool_statistics {
+    latency_histogram wait;  // push to start of execution
+    latency_histogram run;   // execution time
+    std::vector<worker_statistics> workers;
+    size_t submitted = 0;
+    size_t peak_depth = 0;   // largest number of queued but not started work
+    std::chrono::nanoseconds elapsed{ 0 };
+};
+
+// metrics policy of basic_thread_pool that records nothing.
+// every hook is an empty inline function, so the pool compiles to the same code as without metrics.
+struct no_metrics {
+    static constexpr bool enabled = false;
+    using clock = std::chrono::steady_clock;
+
+    explicit no_metrics(size_t) noexcept {}
+    void on_enqueue(size_t) noexcept {}
+    void on_start(clock::duration) noexcept {}
+    void on_finish(size_t, clock::duration) noexcept {}
+};
+
+// metrics policy of basic_thread_pool.
+// counters are relaxed atomics updated once per work, and read without stopping the pool,
+// so a snapshot taken while work is running is only approximately consistent.
+class pool_metrics {
+public:
+    static constexpr bool enabled = true;
+    using clock = std::chrono::steady_clock;
+
+    explicit pool_metrics(size_t worker_count)
+        : count_{ std::max<size_t>(worker_count, 1) }
+        , workers_{ std::make_unique<worker_counters[]>(count_) }
+        , start_{ clock::now() }
+    {}
+
+    // depth : queued work including this one
+    void on_enqueue(size_t depth) noexcept
+    {
+        submitted_.fetch_add(1, std::memory_order_relaxed);
+        auto peak = peak_depth_.load(std::memory_order_relaxed);
+        while (depth > peak && !peak_depth_.compare_exchange_weak(peak, depth, std::memory_order_relaxed));
+    }
+    void on_start(clock::duration wait) noexcept
+    {
+        wait_.add(wait);
+    }
+    void on_finish(size_t worker, clock::duration run) noexcept
+    {
+        run_.add(run);
+        auto& w = workers_[worker % count_];
+        w.busy.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(run).count(), std::memory_order_relaxed);
+        w.executed.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // steals are counted by the queue and filled in by the pool
+    pool_statistics snapshot() const
+    {
+        pool_statistics s;
+        s.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start_);
+        s.wait = wait_.read();
+        s.run = run_.read();
+        s.submitted = submitted_.load(std::memory_order_relaxed);
+        s.peak_depth = peak_depth_.load(std::memory_order_relaxed);
+        s.workers.resize(count_);
+        for (size_t i = 0; i < count_; ++i) {
+            auto& w = s.workers[i];
+            w.busy = std::chrono::nanoseconds{ workers_[i].busy.load(std::memory_order_relaxed) };
+            w.idle = std::max(s.elapsed - w.busy, std::chrono::nanoseconds{ 0 });
+            w.executed = workers_[i].executed.load(std::memory_order_relaxed);
+        }
+        return s;
+    }
+private:
+    struct atomic_histogram {
+        std::array<std::atomic_size_t, latency_histogram::bucket_count> buckets{};
+        std::atomic_size_t count = 0;
+        std::atomic<long long> total = 0, max = 0;
+
+        void add(clock::duration d) noexcept
+        {
+            auto ns = std::max<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count(), 0);
+            auto b = std::min<size_t>(ns ? std::bit_width((unsigned long long)ns) - 1 : 0, latency_histogram::bucket_count - 1);
+            buckets[b].fetch_add(1, std::memory_order_relaxed);
+            count.fetch_add(1, std::memory_order_relaxed);
+            total.fetch_add(ns, std::memory_order_relaxed);
+            auto m = max.load(std::memory_order_relaxed);
+            while (ns > m && !max.compare_exchange_weak(m, ns, std::memory_order_relaxed));
+        }
+        latency_histogram read() const noexcept
+        {
+            latency_histogram h;
+            for (size_t i = 0; i < h.bucket_count; ++i) h.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+            h.count = count.load(std::memory_order_relaxed);
+            h.total = std::chrono::nanoseconds{ total.load(std::memory_order_relaxed) };
+            h.max = std::chrono::nanoseconds{ max.load(std::memory_order_relaxed) };
+            return h;
+        }
+    };
+    // padded to keep workers from sharing a cache line
+    struct alignas(64) worker_counters {
+        std::atomic<long long> busy = 0;
+        std::atomic_size_t executed = 0;
+    };
+
+    size_t count_;
+    std::unique_ptr<worker_counters[]> workers_;
+    clock::time_point start_;
+    atomic_histogram wait_, run_;
+    std::atomic_size_t submitted_ = 0, peak_depth_ = 0;
+};
+
+}
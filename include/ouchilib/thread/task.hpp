@@ -1,9 +1,19 @@
 ﻿#pragma once
 #include <type_traits>
-#include <list>
+#include <vector>
 #include <exception>
 #include <atomic>
 #include <mutex>
+#include <variant>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <stdexcept>
+#include <stop_token>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <utility>
 #include "ouchilib/math/infinity.hpp"
 
 namespace ouchi::thread {
@@ -12,13 +22,28 @@ namespace detail {
 
 template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 template<class... Ts> overloaded(Ts...)->overloaded<Ts...>;
+
+// a task function takes no argument or the std::stop_token of the launch
+template<class F>
+inline constexpr bool is_task_function_v = std::is_invocable_v<F&> || std::is_invocable_v<F&, std::stop_token>;
+
+template<class F>
+decltype(auto) invoke_task_function(F& func, const std::stop_token& token)
+{
+    if constexpr (std::is_invocable_v<F&>) return std::invoke(func);
+    else return std::invoke(func, token);
+}
+
+template<class F>
+using task_function_result_t = decltype(invoke_task_function(std::declval<F&>(), std::declval<const std::stop_token&>()));
 } // namespace detail
 
 
 class task_base {
 public:
+    // cancelled : skipped because the launch was cancelled or a preprocess failed
     enum class status {
-        waiting, working, completed, failed
+        waiting, working, completed, failed, cancelled
     };
 
     task_base()
@@ -29,10 +54,12 @@ public:
 
     task_base& before(task_base& postprocess) {
         postprocess.preprocesses_.push_back(this);
+        postprocesses_.push_back(&postprocess);
         return *this;
     }
     task_base& after(task_base& preprocess) {
         preprocesses_.push_back(&preprocess);
+        preprocess.postprocesses_.push_back(this);
         return *this;
     }
     bool ready() const noexcept
@@ -52,12 +79,44 @@ public:
     status get_status() const noexcept {
         return status_;
     }
+    // make the task runnable again
+    virtual void reset() noexcept
+    {
+        std::lock_guard<std::recursive_mutex> lock(mtx_);
+        status_ = status::waiting;
+        retry_after_.reset();
+    }
 protected:
-    virtual bool execute() noexcept = 0;
+    // token is signalled when the launch is cancelled
+    virtual bool execute(const std::stop_token& token) noexcept = 0;
+    // mark a waiting task cancelled without running it
+    bool cancel() noexcept
+    {
+        std::lock_guard<std::recursive_mutex> lock(mtx_);
+        if (status_ != status::waiting) return false;
+        status_ = status::cancelled;
+        return true;
+    }
+    bool get_ready() noexcept
+    {
+        std::lock_guard<std::recursive_mutex> lock(mtx_);
+        // the tasksystem starts a task once the preprocesses in its graph are done, and ignores the others
+        bool scheduled = std::exchange(scheduled_, false);
+        if (done() || !(scheduled || ready())) return false;
+        status_ = status::working;
+        return true;
+    }
 
-    std::list<task_base*> preprocesses_;
+    std::vector<task_base*> preprocesses_;
+    std::vector<task_base*> postprocesses_;
     status status_;
     mutable std::recursive_mutex mtx_;
+    // position in the tasksystem graph being built or run
+    size_t index_ = 0;
+    // set by the tasksystem for the next execute(), which then skips the check of the preprocesses
+    bool scheduled_ = false;
+    // set by execute() to ask the tasksystem to run the task again after the delay
+    std::optional<std::chrono::nanoseconds> retry_after_;
     friend class tasksystem;
 };
 
@@ -67,7 +126,7 @@ template<class F, class Handler, class = void>
 class failable_task;
 
 template<class F>
-class basic_task<F, std::enable_if_t<std::is_invocable_v<F>>> : public task_base {
+class basic_task<F, std::enable_if_t<detail::is_task_function_v<std::remove_reference_t<F>>>> : public task_base {
 public:
     using func_type = std::remove_reference_t<F>;
     explicit basic_task(F&& func)
@@ -75,18 +134,11 @@ public:
     {}
     virtual ~basic_task() = default;
 protected:
-    bool get_ready() noexcept
-    {
-        std::lock_guard<std::recursive_mutex> lock(mtx_);
-        if (done() || !ready()) return false;
-        status_ = status::working;
-        return true;
-    }
-    virtual bool execute() noexcept override 
+    virtual bool execute(const std::stop_token& token) noexcept override
     {
         if (!get_ready()) return false;
         try {
-            std::invoke(func_);
+            detail::invoke_task_function(func_, token);
             status_ = status::completed;
         } catch (...) { status_ = status::failed; }
         return true;
@@ -95,6 +147,116 @@ protected:
     func_type func_;
 };
 
+// task that produces a value of type R.
+// successors created with tasksystem::create_task(func, producers...) receive it as an argument.
+template<class R>
+class result_task : public task_base {
+public:
+    using result_type = R;
+
+    // the result after the task completed. throws if the task has not completed.
+    const R& get() const
+    {
+        if (!result_) throw std::logic_error("result_task: no result");
+        return *result_;
+    }
+    void reset() noexcept override
+    {
+        task_base::reset();
+        result_.reset();
+    }
+    // hands the result over to a successor.
+    // moved out if there is a single consumer, copied otherwise.
+    R take()
+    {
+        if (!result_) throw std::logic_error("result_task: no result");
+        if (consumers_ == 1) return std::move(*result_);
+        if constexpr (std::is_copy_constructible_v<R>) return *result_;
+        else throw std::logic_error("result_task: move only result is consumed more than once");
+    }
+protected:
+    std::optional<R> result_;
+private:
+    template<class, class...> friend class data_task;
+    size_t consumers_ = 0;
+};
+
+namespace detail {
+template<class R>
+using data_task_base = std::conditional_t<std::is_void_v<R>, task_base, result_task<R>>;
+
+// a task without inputs may take the stop token instead
+template<class F, class ...Ins>
+struct data_task_result : std::invoke_result<F&, Ins...> {};
+template<class F>
+struct data_task_result<F> {
+    using type = task_function_result_t<F>;
+};
+template<class F, class ...Ins>
+using data_task_result_t = typename data_task_result<std::remove_reference_t<F>, Ins...>::type;
+} // namespace detail
+
+// calls func with the results of Ins producing tasks, which run before this task.
+template<class F, class ...Ins>
+class data_task : public detail::data_task_base<detail::data_task_result_t<F, Ins...>> {
+public:
+    using func_type = std::remove_reference_t<F>;
+    using result_type = detail::data_task_result_t<F, Ins...>;
+
+    data_task(F&& func, result_task<Ins>& ...inputs)
+        : func_{ std::forward<F>(func) }
+        , inputs_{ &inputs... }
+    {
+        ((this->after(inputs), ++inputs.consumers_), ...);
+    }
+protected:
+    virtual bool execute(const std::stop_token& token) noexcept override
+    {
+        if (!task_base::get_ready()) return false;
+        try {
+            if constexpr (sizeof...(Ins) == 0) {
+                if constexpr (std::is_void_v<result_type>)
+                    detail::invoke_task_function(func_, token);
+                else
+                    this->result_.emplace(detail::invoke_task_function(func_, token));
+            } else {
+                std::apply([this](auto* ...in) {
+                    if constexpr (std::is_void_v<result_type>)
+                        std::invoke(func_, in->take()...);
+                    else
+                        this->result_.emplace(std::invoke(func_, in->take()...));
+                }, inputs_);
+            }
+            task_base::status_ = task_base::status::completed;
+        } catch (...) { task_base::status_ = task_base::status::failed; }
+        return true;
+    }
+private:
+    func_type func_;
+    std::tuple<result_task<Ins>*...> inputs_;
+};
+
+// delay before the n-th retry (n starts at 0) : initial * multiplier^n capped by max,
+// then shortened at random by up to `jitter` of itself so that retries of many tasks spread out.
+struct backoff {
+    std::chrono::nanoseconds initial = std::chrono::milliseconds(10);
+    std::chrono::nanoseconds max = std::chrono::seconds(10);
+    double multiplier = 2.0;
+    double jitter = 0.5;
+
+    template<class URBG>
+    std::chrono::nanoseconds delay(size_t n, URBG& g) const
+    {
+        auto d = (double)initial.count();
+        for (size_t i = 0; i < n && d < (double)max.count(); ++i) d *= multiplier;
+        d = std::min(d, (double)max.count());
+        d *= 1.0 - std::clamp(jitter, 0.0, 1.0) * std::uniform_real_distribution<double>(0.0, 1.0)(g);
+        return std::chrono::nanoseconds{ static_cast<std::chrono::nanoseconds::rep>(d) };
+    }
+};
+
+// without backoff, retries run back to back on the same thread.
+// with backoff, a failed task gives its thread back and the tasksystem runs it again after the delay.
 struct retry_on_fail {
     retry_on_fail(size_t max_try)
         : max_try_{ max_try }
@@ -102,6 +264,19 @@ struct retry_on_fail {
     retry_on_fail(ouchi::math::infinity max_try)
         : max_try_{ max_try }
     {}
+    retry_on_fail(size_t max_try, const backoff& b)
+        : max_try_{ max_try }
+        , backoff_{ b }
+    {}
+    retry_on_fail(ouchi::math::infinity max_try, const backoff& b)
+        : max_try_{ max_try }
+        , backoff_{ b }
+    {}
+
+    const std::optional<backoff>& get_backoff() const noexcept
+    {
+        return backoff_;
+    }
 
     bool can_retry(size_t current)
     {
@@ -112,37 +287,68 @@ struct retry_on_fail {
     }
 private:
     std::variant<size_t, ouchi::math::infinity> max_try_;
+    std::optional<backoff> backoff_;
 };
 
 template<class F, class Handler>
-class failable_task<F, Handler, std::enable_if_t<std::is_invocable_v<F> && std::is_invocable_v<Handler, std::exception_ptr>>> : public basic_task<F> {
+class failable_task<F, Handler, std::enable_if_t<detail::is_task_function_v<std::remove_reference_t<F>> && std::is_invocable_v<Handler, std::exception_ptr>>> : public basic_task<F> {
 public:
     using error_handler_type = std::remove_reference_t<Handler>;
     failable_task(F&& func, const retry_on_fail& r, Handler&& h)
         : basic_task<F>(std::forward<F>(func))
         , r_{ r }
         , error_handler_{ std::forward<Handler>(h) }
+        , rng_{ std::random_device{}() }
     {}
+    void reset() noexcept override
+    {
+        basic_task<F>::reset();
+        retry_count_ = 0;
+    }
 protected:
-    virtual bool execute() noexcept override
+    // retrying stops as soon as the launch is cancelled
+    virtual bool execute(const std::stop_token& token) noexcept override
     {
-        size_t retry_count = 0;
         if (!basic_task<F>::get_ready()) return false;
+        if (auto& b = r_.get_backoff()) {
+            // one attempt per call
+            try {
+                detail::invoke_task_function(basic_task<F>::func_, token);
+                task_base::status_ = task_base::status::completed;
+                retry_count_ = 0;
+                return true;
+            } catch (...) {
+                std::invoke(error_handler_, std::current_exception());
+            }
+            std::lock_guard<std::recursive_mutex> lock(task_base::mtx_);
+            if (!token.stop_requested() && r_.can_retry(retry_count_)) {
+                task_base::retry_after_ = b->delay(retry_count_++, rng_);
+                task_base::status_ = task_base::status::waiting;
+            } else {
+                task_base::status_ = task_base::status::failed;
+                retry_count_ = 0;
+            }
+            return true;
+        }
+        // every attempt in this call
+        size_t retry_count = 0;
         do {
             try {
-                std::invoke(basic_task<F>::func_);
+                detail::invoke_task_function(basic_task<F>::func_, token);
                 task_base::status_ = task_base::status::completed;
                 return true;
             } catch (...) {
                 std::invoke(error_handler_, std::current_exception());
             }
-        } while (r_.can_retry(retry_count++));
+        } while (!token.stop_requested() && r_.can_retry(retry_count++));
         task_base::status_ = task_base::status::failed;
         return true;
     }
 private:
     retry_on_fail r_;
     error_handler_type error_handler_;
+    size_t retry_count_ = 0;
+    std::minstd_rand rng_;
 };
 }
 
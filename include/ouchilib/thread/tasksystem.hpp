@@ -4,72 +4,373 @@
 #include <variant>
 #include <compare>
 #include <memory>
-#include <future>
-#include <list>
-#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdexcept>
 #include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <stop_token>
+#include <utility>
 #include "task.hpp"
+#include "thread-pool.hpp"
+#include "timer_wheel.hpp"
 
 namespace ouchi::thread {
 
 class tasksystem {
 public:
-    template<class F>
-    auto create_task(F&& func)
-        -> std::enable_if_t<std::is_invocable_v<std::remove_cvref_t<F>>, task_base&>
+    // what happens to the rest of a launch when a task fails
+    enum class failure_policy {
+        run_dependents,     // run every task anyway
+        cancel_dependents,  // cancel the tasks depending on the failed one, directly or indirectly
+        cancel_all,         // cancel the whole launch
+    };
+
+    struct launch_statistics {
+        size_t tasks = 0;                     // tasks run by the launch
+        std::chrono::nanoseconds elapsed{ 0 };
+        size_t threads = 0;                   // 0 if run on the calling thread
+    };
+
+    tasksystem() = default;
+    // run tasks on a pool owned by the caller
+    explicit tasksystem(thread_pool& pool)
+        : pool_{ &pool }
+    {}
+    tasksystem(const tasksystem&) = delete;
+
+    // returns result_task<R>& if func returns R, task_base& if it returns void.
+    // func may take the std::stop_token of the launch.
+    template<class F, std::enable_if_t<detail::is_task_function_v<std::remove_cvref_t<F>>>* = nullptr>
+    decltype(auto) create_task(F&& func)
     {
-        return *tasks_.emplace_back(new basic_task<F>(std::forward<F>(func)));
+        using result_type = detail::task_function_result_t<std::remove_cvref_t<F>>;
+        if constexpr (std::is_void_v<result_type>)
+            return static_cast<task_base&>(*tasks_.emplace_back(new basic_task<F>(std::forward<F>(func))));
+        else
+            return static_cast<result_task<result_type>&>(*tasks_.emplace_back(new data_task<F>(std::forward<F>(func))));
+    }
+
+    /// <summary>
+    /// create a task running after inputs, which is called with their results.
+    /// a result is moved into its consumer when it has only one, and copied otherwise.
+    /// </summary>
+    template<class F, class ...Ins,
+             std::enable_if_t<(sizeof...(Ins) > 0) && std::is_invocable_v<std::remove_cvref_t<F>&, Ins...>>* = nullptr>
+    decltype(auto) create_task(F&& func, result_task<Ins>& ...inputs)
+    {
+        using task_type = data_task<F, Ins...>;
+        using result_type = typename task_type::result_type;
+        auto* t = new task_type(std::forward<F>(func), inputs...);
+        tasks_.emplace_back(t);
+        if constexpr (std::is_void_v<result_type>)
+            return static_cast<task_base&>(*t);
+        else
+            return static_cast<result_task<result_type>&>(*t);
     }
 
     template<class F>
     auto create_task(F&& func, const retry_on_fail& r)
-        -> std::enable_if_t<std::is_invocable_v<std::remove_cvref_t<F>>, task_base&>
+        -> std::enable_if_t<detail::is_task_function_v<std::remove_cvref_t<F>>, task_base&>
     {
         return create_task(std::forward<F>(func), r, [](...) {});
     }
 
     template<class F, class ErrorHandler>
     auto create_task(F&& func, const retry_on_fail& r, ErrorHandler&& error_handler)
-        -> std::enable_if_t<std::is_invocable_v<std::remove_cvref_t<F>>, task_base&>
+        -> std::enable_if_t<detail::is_task_function_v<std::remove_cvref_t<F>>, task_base&>
     {
         return *tasks_.emplace_back(new failable_task<F, ErrorHandler>(std::forward<F>(func), r, std::forward<ErrorHandler>(error_handler)));
     }
 
+    /// <summary>
+    /// run every unfinished task and block until all of them are done.
+    /// a task is started when its last preprocess finishes, so the cost is proportional to the number of edges.
+    /// max_thread_count == 0 runs everything on the calling thread.
+    /// otherwise tasks run on a thread_pool kept across launches (or the pool given to the constructor).
+    /// after freeze(), every launch resets and runs the whole frozen graph.
+    /// </summary>
     void launch(size_t max_thread_count = 0) {
-        size_t completed = 0;
-        std::map<std::intptr_t, std::future<void>> results;
-        while (completed != tasks_.size()) {
-            completed = 0;
-            for (auto& taskptr : tasks_) {
-                if (taskptr->done()) {
-                    ++completed;
-                    continue;
-                }
-                if (taskptr->get_status() == task_base::status::working) {
-                    using namespace std::literals::chrono_literals;
-                    auto& f = results[(std::intptr_t)taskptr.get()];
-                    if (std::future_status::ready == f.wait_for(1us)) {
-                        (void)f.get();
-                        results.erase((std::intptr_t)taskptr.get());
+        auto start = std::chrono::steady_clock::now();
+        if (frozen_) {
+            for (auto* t : frozen_->tasks) t->reset();
+            run(*frozen_, max_thread_count);
+        } else {
+            auto g = build_graph(false);
+            run(g, max_thread_count);
+        }
+        last_launch_.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+    }
+    // statistics of the latest launch. scheduling details are available from an instrumented pool
+    const launch_statistics& last_launch() const noexcept
+    {
+        return last_launch_;
+    }
+
+    /// <summary>
+    /// sort the current tasks and edges topologically into a compact graph reused by every later launch,
+    /// so that repeated launches do not allocate in the tasksystem (the queue of a thread pool may, for its own storage).
+    /// tasks and edges added afterwards are ignored until freeze() is called again :
+    /// a frozen task waits only for the preprocesses it had when frozen.
+    /// </summary>
+    void freeze()
+    {
+        frozen_ = std::make_unique<graph>(build_graph(true));
+    }
+    void unfreeze() noexcept
+    {
+        frozen_.reset();
+    }
+    bool frozen() const noexcept
+    {
+        return (bool)frozen_;
+    }
+    // make every task runnable again
+    void reset() noexcept
+    {
+        for (auto& t : tasks_) t->reset();
+    }
+
+    /// <summary>
+    /// cancel the running launch. may be called from a task or another thread.
+    /// tasks not started yet become cancelled and running tasks see their stop token signalled.
+    /// </summary>
+    void cancel() noexcept
+    {
+        {
+            // stop_ is replaced by the next launch once requested
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_.request_stop();
+        }
+        // wake the launcher so that delayed retries are cancelled now
+        cv_.notify_all();
+    }
+    void set_failure_policy(failure_policy p) noexcept
+    {
+        failure_policy_ = p;
+    }
+    failure_policy get_failure_policy() const noexcept
+    {
+        return failure_policy_;
+    }
+
+private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+
+    // tasks in topological order.
+    // successors of tasks[i] are successors[offsets[i]] ... successors[offsets[i + 1] - 1]
+    struct graph {
+        std::vector<task_base*> tasks;
+        std::vector<size_t> offsets;
+        std::vector<size_t> successors;
+        std::vector<size_t> indegree;
+        std::unique_ptr<std::atomic_size_t[]> pending;
+        std::unique_ptr<std::atomic_bool[]> skip;  // a preprocess failed
+        std::vector<size_t> ready;  // work list of the inline launch
+    };
+
+    // all == false takes unfinished tasks only
+    graph build_graph(bool all)
+    {
+        std::vector<task_base*> nodes;
+        nodes.reserve(tasks_.size());
+        for (auto& t : tasks_) {
+            t->index_ = npos;
+            if (all || !t->done()) {
+                t->index_ = nodes.size();
+                nodes.push_back(t.get());
+            }
+        }
+        auto n = nodes.size();
+        auto member = [&nodes](const task_base* t) {
+            return t->index_ < nodes.size() && nodes[t->index_] == t;
+        };
+        // kahn's algorithm. some task is never ready if the graph has a cycle.
+        graph g;
+        g.indegree.assign(n, 0);
+        for (auto* t : nodes)
+            for (auto* s : t->postprocesses_)
+                if (member(s)) ++g.indegree[s->index_];
+        auto indeg = g.indegree;
+        g.tasks.reserve(n);
+        for (size_t i = 0; i < n; ++i)
+            if (indeg[i] == 0) g.tasks.push_back(nodes[i]);
+        for (size_t i = 0; i < g.tasks.size(); ++i) {
+            for (auto* s : g.tasks[i]->postprocesses_) {
+                if (member(s) && --indeg[s->index_] == 0) g.tasks.push_back(s);
+            }
+        }
+        if (g.tasks.size() != n) throw std::logic_error("tasksystem: cyclic dependency");
+        // renumber in topological order
+        for (size_t i = 0; i < n; ++i) {
+            g.indegree[i] = 0;
+            g.tasks[i]->index_ = i;
+        }
+        nodes = g.tasks;
+        g.offsets.reserve(n + 1);
+        for (auto* t : g.tasks) {
+            g.offsets.push_back(g.successors.size());
+            for (auto* s : t->postprocesses_) {
+                if (!member(s)) continue;
+                g.successors.push_back(s->index_);
+                ++g.indegree[s->index_];
+            }
+        }
+        g.offsets.push_back(g.successors.size());
+        g.pending = std::make_unique<std::atomic_size_t[]>(n);
+        g.skip = std::make_unique<std::atomic_bool[]>(n);
+        g.ready.reserve(n);
+        return g;
+    }
+    thread_pool* get_pool(size_t max_thread_count)
+    {
+        if (pool_) return pool_;
+        if (max_thread_count == 0) return nullptr;
+        if (!own_pool_ || own_pool_->size() != max_thread_count)
+            own_pool_ = std::make_unique<thread_pool>(max_thread_count);
+        return own_pool_.get();
+    }
+    void run(graph& g, size_t max_thread_count)
+    {
+        auto n = g.tasks.size();
+        last_launch_ = { n, std::chrono::nanoseconds{ 0 }, 0 };
+        if (n == 0) return;
+        for (size_t i = 0; i < n; ++i) {
+            g.pending[i] = g.indegree[i];
+            g.skip[i] = false;
+        }
+        {
+            // a stop state is made only after a cancelled launch, so that launches do not allocate
+            std::lock_guard<std::mutex> lock(mtx_);
+            if (stop_.stop_requested()) {
+                stop_ = std::stop_source{};
+                token_ = stop_.get_token();
+            }
+        }
+        running_ = &g;
+        running_pool_ = get_pool(max_thread_count);
+        if (running_pool_) last_launch_.threads = running_pool_->size();
+        if (!running_pool_) {
+            for (size_t i = n; i-- > 0;)
+                if (g.indegree[i] == 0) g.ready.push_back(i);
+            auto retry = [&g](size_t i) { g.ready.push_back(i); };
+            while (true) {
+                while (!g.ready.empty()) {
+                    auto i = g.ready.back();
+                    g.ready.pop_back();
+                    if (!execute(g, i)) continue;
+                    for (auto k = g.offsets[i]; k < g.offsets[i + 1]; ++k) {
+                        if (--g.pending[g.successors[k]] == 0) g.ready.push_back(g.successors[k]);
                     }
-                    continue;
                 }
-                if (taskptr->ready() && results.size() < max_thread_count) {
-                    results.emplace(std::piecewise_construct,
-                                    std::forward_as_tuple((std::intptr_t)taskptr.get()),
-                                    std::forward_as_tuple(std::async(std::launch::async, [&taskptr]() { (void)taskptr->execute(); })));
-                    continue;
+                if (retries_.empty()) break;
+                // nothing to do until the next retry
+                if (token_.stop_requested()) {
+                    retries_.expire_all(retry);
+                } else {
+                    // cancel() from another thread wakes the wait
+                    {
+                        std::unique_lock<std::mutex> ul(mtx_);
+                        cv_.wait_until(ul, *retries_.next_expiry(), [this] { return token_.stop_requested(); });
+                    }
+                    retries_.advance(std::chrono::steady_clock::now(), retry);
                 }
-                else if (taskptr->ready()) {
-                    (void)taskptr->execute();
+            }
+            return;
+        }
+        remaining_ = n;
+        finished_ = false;
+        for (size_t i = 0; i < n && g.indegree[i] == 0; ++i) {
+            running_pool_->push([this, i]() { run_from(i); });
+        }
+        // the launching thread drives the retry timers while the workers run
+        auto retry = [this](size_t i) { running_pool_->push([this, i]() { run_from(i); }); };
+        std::unique_lock<std::mutex> ul(mtx_);
+        while (!finished_) {
+            if (token_.stop_requested()) retries_.expire_all(retry);
+            else retries_.advance(std::chrono::steady_clock::now(), retry);
+            if (auto next = retries_.next_expiry()) cv_.wait_until(ul, *next);
+            else cv_.wait(ul);
+        }
+    }
+    // runs or cancels task i and applies the failure policy.
+    // returns false if the task asked to be retried later, in which case it is not finished.
+    bool execute(graph& g, size_t i)
+    {
+        auto* t = g.tasks[i];
+        if (token_.stop_requested() || g.skip[i].load(std::memory_order_relaxed)) {
+            (void)t->cancel();
+        } else {
+            t->scheduled_ = true;
+            (void)t->execute(token_);
+        }
+        if (auto delay = std::exchange(t->retry_after_, std::nullopt)) {
+            if (running_pool_) {
+                {
+                    std::lock_guard<std::mutex> lock(mtx_);
+                    retries_.schedule_after(*delay, i);
                 }
+                cv_.notify_all();
+            } else {
+                retries_.schedule_after(*delay, i);
             }
+            return false;
+        }
+        auto s = t->get_status();
+        if (s != task_base::status::failed && s != task_base::status::cancelled) return true;
+        if (failure_policy_ == failure_policy::cancel_all && s == task_base::status::failed) {
+            stop_.request_stop();
+        } else if (failure_policy_ != failure_policy::run_dependents) {
+            // published to the successors by the decrement of their pending counts
+            for (auto k = g.offsets[i]; k < g.offsets[i + 1]; ++k)
+                g.skip[g.successors[k]].store(true, std::memory_order_relaxed);
+        }
+        return true;
+    }
+    // executes task i on a worker. the first successor made ready is continued on the same worker.
+    void run_from(size_t i)
+    {
+        auto& g = *running_;
+        while (i != npos) {
+            // a retry is started again by the launcher
+            if (!execute(g, i)) return;
+            size_t next = npos;
+            for (auto k = g.offsets[i]; k < g.offsets[i + 1]; ++k) {
+                auto s = g.successors[k];
+                if (--g.pending[s] != 0) continue;
+                if (next == npos) next = s;
+                else running_pool_->push([this, s]() { run_from(s); });
+            }
+            if (--remaining_ == 0) {
+                // launch() may return as soon as finished_ is observed. nothing is touched after this.
+                std::lock_guard<std::mutex> lock(mtx_);
+                finished_ = true;
+                cv_.notify_all();
+                return;
+            }
+            i = next;
         }
     }
 
-private:
-    std::list<std::unique_ptr<task_base>> tasks_;
+    std::vector<std::unique_ptr<task_base>> tasks_;
+    thread_pool* pool_ = nullptr;
+    std::unique_ptr<thread_pool> own_pool_;
+    std::unique_ptr<graph> frozen_;
+    graph* running_ = nullptr;
+    thread_pool* running_pool_ = nullptr;
+    std::atomic_size_t remaining_ = 0;
+    bool finished_ = false;
+    launch_statistics last_launch_;
+    failure_policy failure_policy_ = failure_policy::run_dependents;
+    std::stop_source stop_;  // guarded by mtx_ when replaced
+    std::stop_token token_ = stop_.get_token();
+    // tasks waiting for their next attempt. guarded by mtx_ while the pool runs
+    timer_wheel<size_t> retries_;
+    std::mutex mtx_;
+    std::condition_variable cv_;
 };
 
 }
-
@@ -4,62 +4,118 @@
 #include <mutex>
 #include <condition_variable>
 #include <memory>
-#include <queue>
 #include <vector>
 #include <atomic>
 #include <algorithm>
+#include <future>
+#include <chrono>
+#include <string>
+#include <stop_token>
 
 #include "work.hpp"
+#include "work_queue.hpp"
+#include "affinity.hpp"
+#include "pool_metrics.hpp"
 
 namespace ouchi::thread {
 
-class thread_pool {
-    std::mutex work_mtx_;
+namespace detail {
 
-    std::queue<std::unique_ptr<work_base>> works_;
+// work may take the pool's std::stop_token as its only argument
+template<class F>
+inline constexpr bool takes_stop_token = std::is_invocable_v<F&, std::stop_token> && !std::is_invocable_v<F&>;
+
+template<class F>
+struct work_result {
+    using type = std::invoke_result_t<F&>;
+};
+template<class F> requires takes_stop_token<F>
+struct work_result<F> {
+    using type = std::invoke_result_t<F&, std::stop_token>;
+};
+template<class F>
+using work_result_t = typename work_result<F>::type;
+
+template<class F>
+using packaged_work = std::conditional_t<takes_stop_token<F>,
+                                         std::packaged_task<work_result_t<F>(std::stop_token)>,
+                                         std::packaged_task<work_result_t<F>()>>;
+
+} // namespace detail
+
+// Queue : queue policy. see work_queue.hpp
+// Metrics : metrics policy. see pool_metrics.hpp
+template<class Queue, class Metrics = no_metrics>
+class basic_thread_pool {
+    // declared before queue_ so that it outlives every queued work
+    work_arena arena_;
+    Metrics metrics_;
+    Queue queue_;
     std::vector<std::thread> threads_;
-    std::condition_variable cv_;
-    volatile std::atomic_bool pause_ = false, finish_ = false;
-    std::atomic_uint processing_ = 0;
+
+    std::mutex sleep_mtx_;
+    std::condition_variable cv_, idle_cv_;
+    // queued_ : pushed but not started. unfinished_ : pushed but not finished.
+    std::atomic_size_t queued_ = 0, unfinished_ = 0;
+    std::atomic_size_t sleeping_ = 0, waiting_ = 0;
+    std::atomic_bool pause_ = false, finish_ = false;
+    // workers still being placed by the constructor
+    std::atomic_size_t starting_ = 0;
+    std::atomic_bool started_ = false;
+    // source of the tokens given to work. replaced after every cancel()
+    std::stop_source stop_source_;
+    mutable std::mutex stop_mtx_;
+
+    inline static thread_local const basic_thread_pool* current_pool_ = nullptr;
+    inline static thread_local size_t current_index_ = no_worker;
 
 public:
-    thread_pool(size_t thread_count = 2)
-    {
-        auto poll = [this]() {
-            std::unique_ptr<work_base> f;
-            while (true) {
-                {
-                    std::unique_lock<decltype(work_mtx_)> ul(work_mtx_);
-                    while (works_.empty() || pause_) {
-                        if (finish_) return;
-                        cv_.wait(ul);
-                    }
-                    ++processing_;
-                    f = std::move(works_.front());
-                    works_.pop();
-                }
-                f->operator()();
-                --processing_;
-                f.reset();
-            }
-        };
-        auto actual_tc = std::max(thread_count, 1ull);
+    basic_thread_pool(size_t thread_count = 2)
+        : basic_thread_pool(default_options(thread_count))
+    {}
+    /// <summary>
+    /// workers are named and pinned as options says before they accept work.
+    /// the constructor returns after every worker has been placed.
+    /// failure to pin or name a thread is ignored.
+    /// </summary>
+    explicit basic_thread_pool(const pool_options& options)
+        : metrics_(std::max<size_t>(options.thread_count, 1))
+        , queue_(std::max<size_t>(options.thread_count, 1))
+    {
+        auto actual_tc = std::max<size_t>(options.thread_count, 1);
+        std::vector<std::vector<unsigned>> nodes;
+        if (options.spread_numa_nodes && options.cpus.empty()) nodes = numa_nodes();
+        starting_ = actual_tc;
         threads_.reserve(actual_tc);
-        for (size_t i = 0; i < actual_tc; ++i)
-            threads_.emplace_back(poll);
+        for (size_t i = 0; i < actual_tc; ++i) {
+            threads_.emplace_back([this, i, &options, &nodes]() {
+                if (!options.name.empty()) set_current_thread_name(options.name + '-' + std::to_string(i));
+                if (auto cpus = options.cpus_of(i, nodes); !cpus.empty()) set_current_thread_affinity(cpus);
+                // per worker queue storage is allocated after pinning
+                if constexpr (requires(Queue& q) { q.on_worker_start(i); }) queue_.on_worker_start(i);
+                // nobody may steal from a queue that is still being replaced
+                if (--starting_ == 0) {
+                    started_ = true;
+                    started_.notify_all();
+                }
+                started_.wait(false);
+                poll(i);
+            });
+        }
+        started_.wait(false);
     }
-    thread_pool(const thread_pool&) = delete;
-    ~thread_pool()
+    basic_thread_pool(const basic_thread_pool&) = delete;
+    // queued work is discarded and running work is asked to stop
+    ~basic_thread_pool()
     {
+        cancel();
+        wait();
         {
-            std::unique_lock<decltype(work_mtx_)> ul(work_mtx_);
-            std::queue<std::unique_ptr<work_base>> tmp;
-            works_.swap(tmp);
+            std::lock_guard<std::mutex> lock(sleep_mtx_);
+            finish_ = true;
         }
-        wait();
-        finish_ = true;
+        cv_.notify_all();
         for (auto& i : threads_) {
-            cv_.notify_all();
             i.join();
         }
     }
@@ -67,50 +123,268 @@ public:
     template<class F, class ...Args>
     void emplace(Args&& ...args)
     {
-        {
-            std::unique_lock<decltype(work_mtx_)> ul(work_mtx_);
-            static_assert(std::is_constructible_v<F, Args...>);
-            if constexpr (std::is_base_of_v<work_base, F>)
-                works_.push(std::make_unique<F>(std::forward<Args>(args)...));
-            else
-                works_.push(std::make_unique<detail::work<F>>(std::forward<Args>(args))...);
-        }
-        cv_.notify_all();
+        static_assert(std::is_constructible_v<F, Args...>);
+        enqueue(make_work<F>(std::forward<Args>(args)...));
     }
 
+    // functor is called with no argument, or with a std::stop_token signalled by cancel() and shutdown()
     template<class F>
     void push(F&& functor)
     {
-        emplace<F>(std::forward<F>(functor));
+        emplace<std::decay_t<F>>(std::forward<F>(functor));
+    }
+
+    // push with a queue specific hint such as priority. well-formed only if Queue defines hint_type.
+    template<class F, class Q = Queue>
+    void push(F&& functor, typename Q::hint_type hint)
+    {
+        enqueue(make_work<std::decay_t<F>>(std::forward<F>(functor)), hint);
+    }
+
+    // schedule functor and get the future of its result.
+    // waiting on the future waits only for this work, not for the whole pool.
+    template<class F>
+    [[nodiscard]]
+    auto submit(F&& functor)
+        -> std::future<detail::work_result_t<std::decay_t<F>>>
+    {
+        using task_type = detail::packaged_work<std::decay_t<F>>;
+        task_type task(std::forward<F>(functor));
+        auto f = task.get_future();
+        emplace<task_type>(std::move(task));
+        return f;
+    }
+    template<class F, class Q = Queue>
+    [[nodiscard]]
+    auto submit(F&& functor, typename Q::hint_type hint)
+        -> std::future<detail::work_result_t<std::decay_t<F>>>
+    {
+        using task_type = detail::packaged_work<std::decay_t<F>>;
+        task_type task(std::forward<F>(functor));
+        auto f = task.get_future();
+        push(std::move(task), hint);
+        return f;
     }
 
     // unprocessed work
     size_t remaining() const noexcept
     {
-        return processing_ + works_.size();
+        return unfinished_;
+    }
+
+    // allocation statistics of work that did not fit in work_item
+    work_arena::statistics arena_stats() const noexcept
+    {
+        return arena_.stats();
     }
 
+    // snapshot of wait and run time histograms, per worker utilization and steals.
+    // available if Metrics is pool_metrics
+    pool_statistics statistics() const requires Metrics::enabled
+    {
+        auto s = metrics_.snapshot();
+        if constexpr (requires(const Queue& q) { q.steals(size_t{}); }) {
+            for (size_t i = 0; i < s.workers.size(); ++i) s.workers[i].steals = queue_.steals(i);
+        }
+        return s;
+    }
+
+    Queue& queue() noexcept { return queue_; }
+    const Queue& queue() const noexcept { return queue_; }
+
     // number of threads
     size_t size() const noexcept {
         return threads_.size();
     }
+    // whether the calling thread is a worker of this pool
+    bool is_worker() const noexcept
+    {
+        return this_worker() != no_worker;
+    }
 
     // stop after current work
     void pause() noexcept {
         pause_ = true;
     }
 
+    // block until every pushed work is finished.
+    // must not be called from a worker of this pool.
     void wait() noexcept
     {
-        while (remaining())
-            std::this_thread::yield();
+        std::unique_lock<std::mutex> ul(sleep_mtx_);
+        ++waiting_;
+        idle_cv_.wait(ul, [this]() { return remaining() == 0; });
+        --waiting_;
+    }
+
+    // returns false if timed out
+    template<class Rep, class Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) noexcept
+    {
+        std::unique_lock<std::mutex> ul(sleep_mtx_);
+        ++waiting_;
+        auto r = idle_cv_.wait_for(ul, timeout, [this]() { return remaining() == 0; });
+        --waiting_;
+        return r;
     }
 
     void resume() noexcept
     {
-        pause_ = false;
+        {
+            std::lock_guard<std::mutex> lock(sleep_mtx_);
+            pause_ = false;
+        }
         cv_.notify_all();
     }
+
+    // token given to work pushed from now on
+    std::stop_token get_stop_token() const noexcept
+    {
+        std::lock_guard<std::mutex> lock(stop_mtx_);
+        return stop_source_.get_token();
+    }
+
+    /// <summary>
+    /// discard queued work and signal the stop token of running work.
+    /// returns the number of discarded work. work pushed afterwards gets a new token.
+    /// cancellation is cooperative : work that ignores its token runs to the end.
+    /// </summary>
+    size_t cancel() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(stop_mtx_);
+            stop_source_.request_stop();
+            stop_source_ = std::stop_source{};
+        }
+        auto discarded = queue_.clear();
+        queued_ -= discarded;
+        if ((unfinished_ -= discarded) == 0 && waiting_) {
+            { std::lock_guard<std::mutex> lock(sleep_mtx_); }
+            idle_cv_.notify_all();
+        }
+        return discarded;
+    }
+
+    /// <summary>
+    /// let pushed work finish within timeout, then cancel() whatever is left.
+    /// returns true if everything finished in time.
+    /// the pool stays usable afterwards.
+    /// </summary>
+    template<class Rep, class Period>
+    bool shutdown(const std::chrono::duration<Rep, Period>& timeout) noexcept
+    {
+        if (wait_for(timeout)) return true;
+        cancel();
+        return false;
+    }
+
+private:
+    static pool_options default_options(size_t thread_count)
+    {
+        pool_options o;
+        o.thread_count = thread_count;
+        return o;
+    }
+    // records the time from push to start
+    template<class F>
+    struct timed_work {
+        F func;
+        typename Metrics::clock::time_point queued;
+        Metrics* metrics;
+
+        template<class ...Args>
+        timed_work(Metrics& m, Args&& ...args)
+            : func(std::forward<Args>(args)...)
+            , queued{ Metrics::clock::now() }
+            , metrics{ &m }
+        {}
+        void operator()()
+        {
+            metrics->on_start(Metrics::clock::now() - queued);
+            func();
+        }
+    };
+    template<class F>
+    struct stoppable_work {
+        F func;
+        std::stop_token token;
+
+        template<class ...Args>
+        stoppable_work(std::stop_token t, Args&& ...args)
+            : func(std::forward<Args>(args)...)
+            , token{ std::move(t) }
+        {}
+        void operator()() { func(token); }
+    };
+    template<class F, class ...Args>
+    work_item make_work(Args&& ...args)
+    {
+        if constexpr (detail::takes_stop_token<F>)
+            return make_work<stoppable_work<F>>(get_stop_token(), std::forward<Args>(args)...);
+        else if constexpr (Metrics::enabled)
+            return work_item(std::in_place_type<timed_work<F>>, arena_, metrics_, std::forward<Args>(args)...);
+        else
+            return work_item(std::in_place_type<F>, arena_, std::forward<Args>(args)...);
+    }
+    template<class ...Hint>
+    void enqueue(work_item&& w, Hint... hint)
+    {
+        ++unfinished_;
+        auto depth = ++queued_;
+        metrics_.on_enqueue(depth);
+        queue_.push(std::move(w), this_worker(), hint...);
+        notify();
+    }
+    // index of the calling worker or no_worker if the caller does not belong to this pool
+    size_t this_worker() const noexcept
+    {
+        return current_pool_ == this ? current_index_ : no_worker;
+    }
+    void notify()
+    {
+        // a worker going to sleep registers itself under the lock before it checks queued_.
+        if (sleeping_) {
+            { std::lock_guard<std::mutex> lock(sleep_mtx_); }
+            cv_.notify_one();
+        }
+    }
+    void poll(size_t index)
+    {
+        current_pool_ = this;
+        current_index_ = index;
+        while (true) {
+            work_item f;
+            if (!pause_ && (f = queue_.pop(index))) {
+                --queued_;
+                if constexpr (Metrics::enabled) {
+                    auto start = Metrics::clock::now();
+                    f();
+                    f.reset();
+                    metrics_.on_finish(index, Metrics::clock::now() - start);
+                } else {
+                    f();
+                    f.reset();
+                }
+                if (--unfinished_ == 0 && waiting_) {
+                    { std::lock_guard<std::mutex> lock(sleep_mtx_); }
+                    idle_cv_.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> ul(sleep_mtx_);
+            ++sleeping_;
+            while ((queued_ == 0 || pause_) && !finish_)
+                cv_.wait(ul);
+            --sleeping_;
+            if (finish_) return;
+        }
+    }
 };
 
+using thread_pool = basic_thread_pool<shared_queue>;
+using work_stealing_pool = basic_thread_pool<work_stealing_queue>;
+using priority_thread_pool = basic_thread_pool<priority_work_queue>;
+template<class Queue = shared_queue>
+using instrumented_thread_pool = basic_thread_pool<Queue, pool_metrics>;
+
 }
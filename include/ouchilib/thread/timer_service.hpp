@@ -0,0 +1,207 @@
+﻿#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "thread-pool.hpp"
+#include "timer_wheel.hpp"
+#include "../utl/time_keeper.hpp"
+
+namespace ouchi::thread {
+
+/// <summary>
+/// runs delayed and periodic callbacks on a thread pool.
+/// one thread keeps every timer in a timer_wheel and sleeps until the next expiry,
+/// so the number of timers costs memory, not threads. schedule and cancel are O(1).
+/// callbacks run on the pool, never on the timer thread.
+/// Pool is any basic_thread_pool and must outlive the service.
+/// </summary>
+template<class Pool>
+class basic_timer_service {
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+    using callback_type = std::function<void()>;
+public:
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+    using duration = clock::duration;
+
+    // handle of a timer. stays valid across the runs of a periodic timer
+    struct timer_id {
+        size_t index = npos;
+        size_t generation = 0;
+        explicit operator bool() const noexcept { return index != npos; }
+    };
+
+    explicit basic_timer_service(Pool& pool,
+                                 duration resolution = std::chrono::milliseconds(1),
+                                 size_t slot_count = 256)
+        : pool_{ pool }
+        , wheel_(resolution, slot_count)
+    {
+        thread_ = std::thread([this]() { run(); });
+    }
+    basic_timer_service(const basic_timer_service&) = delete;
+    // pending timers are discarded. callbacks already given to the pool still run.
+    ~basic_timer_service()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            stop_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    template<class F>
+    timer_id schedule_at(time_point deadline, F&& callback)
+    {
+        return add(deadline, duration::zero(), std::forward<F>(callback));
+    }
+    template<class Rep, class Period, class F>
+    timer_id schedule_after(const std::chrono::duration<Rep, Period>& delay, F&& callback)
+    {
+        return schedule_at(clock::now() + std::chrono::duration_cast<duration>(delay), std::forward<F>(callback));
+    }
+    /// <summary>
+    /// call callback at first, then every period until cancelled.
+    /// the rate is fixed : a run does not wait for the previous one, and runs missed by a stalled timer thread are skipped.
+    /// </summary>
+    template<class Rep, class Period, class F>
+    timer_id schedule_every(time_point first, const std::chrono::duration<Rep, Period>& period, F&& callback)
+    {
+        auto p = std::max(std::chrono::duration_cast<duration>(period), wheel_.resolution());
+        return add(first, p, std::forward<F>(callback));
+    }
+    template<class Rep, class Period, class F>
+    timer_id schedule_every(const std::chrono::duration<Rep, Period>& period, F&& callback)
+    {
+        return schedule_every(clock::now() + std::chrono::duration_cast<duration>(period), period, std::forward<F>(callback));
+    }
+    // call callback every period of keeper, replacing a thread sleeping on it
+    template<class Clock, class F>
+    timer_id schedule_every(const ouchi::time_keeper<Clock>& keeper, F&& callback)
+    {
+        return schedule_every(keeper.get_duration(), std::forward<F>(callback));
+    }
+
+    // returns false if the timer has already fired or been cancelled.
+    // a run already given to the pool is not recalled.
+    bool cancel(timer_id id) noexcept
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!is_pending_unlocked(id)) return false;
+        wheel_.cancel(entries_[id.index].wheel_id);
+        release(id.index);
+        return true;
+    }
+    bool is_pending(timer_id id) const noexcept
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return is_pending_unlocked(id);
+    }
+    size_t size() const noexcept
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return wheel_.size();
+    }
+private:
+    struct entry {
+        size_t generation = 0;
+        size_t next_free = npos;
+        // shared with the runs queued on the pool
+        std::shared_ptr<callback_type> callback;
+        duration period = duration::zero();  // zero for a one shot timer
+        time_point deadline;
+        typename timer_wheel<size_t>::timer_id wheel_id;
+    };
+
+    template<class F>
+    timer_id add(time_point deadline, duration period, F&& callback)
+    {
+        static_assert(std::is_invocable_v<std::decay_t<F>&>);
+        auto cb = std::make_shared<callback_type>(std::forward<F>(callback));
+        std::lock_guard<std::mutex> lock(mtx_);
+        size_t i;
+        if (free_ == npos) {
+            i = entries_.size();
+            entries_.emplace_back();
+        } else {
+            i = std::exchange(free_, entries_[free_].next_free);
+        }
+        auto& e = entries_[i];
+        e.callback = std::move(cb);
+        e.period = period;
+        e.deadline = deadline;
+        e.wheel_id = wheel_.schedule(deadline, i);
+        // wake the timer thread only if it sleeps past the new deadline
+        if (deadline < sleeping_until_) cv_.notify_one();
+        return { i, e.generation };
+    }
+    bool is_pending_unlocked(timer_id id) const noexcept
+    {
+        return id.index < entries_.size() && entries_[id.index].generation == id.generation && entries_[id.index].callback;
+    }
+    void release(size_t i) noexcept
+    {
+        auto& e = entries_[i];
+        e.callback.reset();
+        ++e.generation;
+        e.next_free = std::exchange(free_, i);
+    }
+    void run()
+    {
+        std::vector<std::shared_ptr<callback_type>> due;
+        std::unique_lock<std::mutex> ul(mtx_);
+        while (!stop_) {
+            auto now = clock::now();
+            wheel_.advance(now, [&](size_t i) {
+                auto& e = entries_[i];
+                due.push_back(e.callback);
+                if (e.period == duration::zero()) {
+                    release(i);
+                    return;
+                }
+                e.deadline += e.period;
+                if (e.deadline <= now) e.deadline += ((now - e.deadline) / e.period + 1) * e.period;
+                e.wheel_id = wheel_.schedule(e.deadline, i);
+            });
+            if (!due.empty()) {
+                // the pool is not called under the lock, so callbacks can use the service
+                ul.unlock();
+                for (auto& cb : due) pool_.push([cb = std::move(cb)]() { (*cb)(); });
+                due.clear();
+                ul.lock();
+                continue;
+            }
+            if (auto next = wheel_.next_expiry()) {
+                sleeping_until_ = *next;
+                cv_.wait_until(ul, *next);
+            } else {
+                sleeping_until_ = time_point::max();
+                cv_.wait(ul);
+            }
+            sleeping_until_ = time_point::min();
+        }
+    }
+
+    Pool& pool_;
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    timer_wheel<size_t> wheel_;
+    std::vector<entry> entries_;
+    size_t free_ = npos;
+    time_point sleeping_until_ = time_point::min();
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+using timer_service = basic_timer_service<thread_pool>;
+
+}
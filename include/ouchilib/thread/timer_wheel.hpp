@@ -0,0 +1,265 @@
+﻿#pragma once
+#include <chrono>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <utility>
+#include <limits>
+#include <bit>
+#include <cstdint>
+
+namespace ouchi::thread {
+
+/// <summary>
+/// hierarchical timing wheel.
+/// time is cut into ticks of `resolution`. level 0 has one slot per tick of the current block of slot_count ticks,
+/// level k has one slot per block of slot_count^k ticks, and timers move down a level when their block begins.
+/// schedule and cancel are O(1). advance costs one slot per elapsed tick and skips runs of empty slots.
+/// timers fire at the first advance at or after the end of their tick, never early.
+/// not thread safe.
+/// </summary>
+template<class T>
+class timer_wheel {
+    static constexpr size_t npos = std::numeric_limits<size_t>::max();
+public:
+    using clock = std::chrono::steady_clock;
+    using time_point = clock::time_point;
+    using duration = clock::duration;
+    static constexpr size_t level_count = 4;
+
+    // handle of a scheduled timer. stale handles are detected by the generation
+    struct timer_id {
+        size_t index = npos;
+        size_t generation = 0;
+        explicit operator bool() const noexcept { return index != npos; }
+    };
+
+    // slot_count is rounded up to a power of two
+    explicit timer_wheel(duration resolution = std::chrono::milliseconds(1),
+                         size_t slot_count = 256,
+                         time_point origin = clock::now())
+        : resolution_{ std::max(resolution, duration{ 1 }) }
+        , origin_{ origin }
+        , bits_{ static_cast<unsigned>(std::countr_zero(std::bit_ceil(std::max<size_t>(slot_count, 2)))) }
+        , heads_(level_count << bits_, npos)
+    {}
+
+    timer_id schedule(time_point deadline, T value)
+    {
+        auto i = allocate();
+        auto& n = nodes_[i];
+        n.tick = std::max(tick_of(deadline), current_);
+        n.value.emplace(std::move(value));
+        link(i);
+        ++size_;
+        return { i, n.generation };
+    }
+    timer_id schedule_after(duration delay, T value)
+    {
+        return schedule(clock::now() + delay, std::move(value));
+    }
+    // returns false if the timer has already fired or been cancelled
+    bool cancel(timer_id id) noexcept
+    {
+        if (!is_pending(id)) return false;
+        unlink(id.index);
+        release(id.index);
+        --size_;
+        return true;
+    }
+    bool is_pending(timer_id id) const noexcept
+    {
+        return id.index < nodes_.size() && nodes_[id.index].generation == id.generation && nodes_[id.index].value;
+    }
+
+    /// <summary>
+    /// fire every timer expiring at or before now by calling f(T&&) in expiry order.
+    /// f may schedule and cancel timers. returns the number of fired timers.
+    /// </summary>
+    template<class F>
+    size_t advance(time_point now, F&& f)
+    {
+        auto target = tick_of(now);
+        std::vector<T> due;
+        while (current_ < target) {
+            if (size_ == 0) {
+                current_ = target;
+                break;
+            }
+            // skip empty slots up to the end of the block
+            auto idx = current_ & mask();
+            auto j = idx;
+            while (j <= mask() && heads_[j] == npos) ++j;
+            auto tick = current_ - idx + j;
+            if (tick >= target) {
+                move_to(target);
+                break;
+            }
+            move_to(tick);
+            if (j > mask()) continue;
+            for (auto i = std::exchange(heads_[j], npos); i != npos;) {
+                auto next = nodes_[i].next;
+                due.push_back(std::move(*nodes_[i].value));
+                release(i);
+                --size_;
+                i = next;
+            }
+            move_to(current_ + 1);
+        }
+        for (auto& d : due) f(std::move(d));
+        return due.size();
+    }
+
+    // fire every timer now regardless of its expiry, in expiry order
+    template<class F>
+    size_t expire_all(F&& f)
+    {
+        std::vector<std::pair<std::uint64_t, T>> due;
+        due.reserve(size_);
+        for (auto& head : heads_) {
+            for (auto i = std::exchange(head, npos); i != npos;) {
+                auto next = nodes_[i].next;
+                due.emplace_back(nodes_[i].tick, std::move(*nodes_[i].value));
+                release(i);
+                i = next;
+            }
+        }
+        size_ = 0;
+        std::stable_sort(due.begin(), due.end(), [](auto& a, auto& b) { return a.first < b.first; });
+        for (auto& d : due) f(std::move(d.second));
+        return due.size();
+    }
+
+    // earliest time at which advance fires something
+    std::optional<time_point> next_expiry() const noexcept
+    {
+        if (size_ == 0) return std::nullopt;
+        // every timer of a level expires before those of the levels above it,
+        // and the slots of a level expire in index order from the current one.
+        auto top = level_count - 1;
+        for (size_t level = 0; level < top; ++level) {
+            auto first = (current_ >> (bits_ * level)) & mask();
+            for (auto s = first; s <= mask(); ++s) {
+                auto i = heads_[(level << bits_) + s];
+                if (i == npos) continue;
+                auto best = std::numeric_limits<std::uint64_t>::max();
+                for (; i != npos; i = nodes_[i].next) best = std::min(best, nodes_[i].tick);
+                return expiry_of(best);
+            }
+        }
+        // the top level also holds parked timers, so all of it is searched
+        auto best = std::numeric_limits<std::uint64_t>::max();
+        for (auto head = heads_.begin() + (top << bits_); head != heads_.end(); ++head) {
+            for (auto i = *head; i != npos; i = nodes_[i].next) best = std::min(best, nodes_[i].tick);
+        }
+        return expiry_of(best);
+    }
+
+    size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    duration resolution() const noexcept { return resolution_; }
+private:
+    struct node {
+        std::uint64_t tick = 0;
+        size_t slot = npos;  // index into heads_
+        size_t prev = npos, next = npos;
+        size_t generation = 0;
+        std::optional<T> value;
+    };
+
+    std::uint64_t mask() const noexcept { return (std::uint64_t{ 1 } << bits_) - 1; }
+    // timers of tick t fire once now reaches the end of t
+    time_point expiry_of(std::uint64_t tick) const noexcept
+    {
+        return origin_ + resolution_ * static_cast<duration::rep>(tick + 1);
+    }
+    std::uint64_t tick_of(time_point tp) const noexcept
+    {
+        if (tp <= origin_) return 0;
+        return static_cast<std::uint64_t>((tp - origin_) / resolution_);
+    }
+    // the lowest level whose current block contains the tick
+    size_t slot_of(std::uint64_t tick) const noexcept
+    {
+        for (size_t level = 0; level < level_count; ++level) {
+            auto shift = bits_ * (level + 1);
+            if (shift >= 64 || (tick >> shift) == (current_ >> shift))
+                return (level << bits_) + ((tick >> (bits_ * level)) & mask());
+        }
+        // out of range. parked in the next top slot to be cascaded, and placed again from there
+        auto top = level_count - 1;
+        return (top << bits_) + (((current_ >> (bits_ * top)) + 1) & mask());
+    }
+    // the blocks beginning at current_ are cascaded as soon as current_ reaches them,
+    // so that the level-0 slots always hold the earliest timers
+    void move_to(std::uint64_t tick)
+    {
+        current_ = tick;
+        if ((current_ & mask()) == 0) cascade();
+    }
+    // move the timers of the blocks beginning at current_ down to the lower levels
+    void cascade()
+    {
+        if (current_ == 0) return;
+        size_t top = 1;
+        while (top + 1 < level_count && ((current_ >> (bits_ * top)) & mask()) == 0) ++top;
+        for (auto level = top; level >= 1; --level) {
+            auto& head = heads_[(level << bits_) + ((current_ >> (bits_ * level)) & mask())];
+            for (auto i = std::exchange(head, npos); i != npos;) {
+                auto next = nodes_[i].next;
+                link(i);
+                i = next;
+            }
+        }
+    }
+    size_t allocate()
+    {
+        if (free_ == npos) {
+            nodes_.emplace_back();
+            return nodes_.size() - 1;
+        }
+        auto i = free_;
+        free_ = nodes_[i].next;
+        return i;
+    }
+    void release(size_t i) noexcept
+    {
+        auto& n = nodes_[i];
+        n.value.reset();
+        ++n.generation;
+        n.slot = npos;
+        n.prev = npos;
+        n.next = free_;
+        free_ = i;
+    }
+    void link(size_t i) noexcept
+    {
+        auto& n = nodes_[i];
+        n.slot = slot_of(n.tick);
+        auto& head = heads_[n.slot];
+        n.prev = npos;
+        n.next = head;
+        if (head != npos) nodes_[head].prev = i;
+        head = i;
+    }
+    void unlink(size_t i) noexcept
+    {
+        auto& n = nodes_[i];
+        if (n.prev != npos) nodes_[n.prev].next = n.next;
+        else heads_[n.slot] = n.next;
+        if (n.next != npos) nodes_[n.next].prev = n.prev;
+    }
+
+    duration resolution_;
+    time_point origin_;
+    unsigned bits_;
+    // level_count levels of slot_count list heads
+    std::vector<size_t> heads_;
+    std::vector<node> nodes_;
+    size_t free_ = npos;
+    size_t size_ = 0;
+    // ticks before current_ have been processed
+    std::uint64_t current_ = 0;
+};
+
+}
@@ -1,5 +1,12 @@
 ﻿#pragma once
 #include <type_traits>
+#include <utility>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <cstddef>
+#include <atomic>
+#include <algorithm>
 
 namespace ouchi::thread {
 
@@ -29,4 +36,183 @@ public:
 
 } // namespace detail
 
+// fixed size block allocator for work that does not fit in work_item.
+// blocks are carved from slabs and recycled through a free list, so
+// steady state scheduling does not touch the global heap.
+class work_arena {
+public:
+    static constexpr size_t block_size = 256;
+    static constexpr size_t blocks_per_slab = 64;
+
+    struct statistics {
+        size_t slab_allocations;     // slabs taken from the global heap
+        size_t oversize_allocations; // work larger than block_size or aligned beyond std::max_align_t
+        size_t block_allocations;    // blocks handed out from the free list
+    };
+
+    work_arena() = default;
+    work_arena(const work_arena&) = delete;
+    ~work_arena()
+    {
+        for (auto* s : slabs_) ::operator delete(s, std::align_val_t{ alignof(std::max_align_t) });
+    }
+
+    // blocks are aligned to std::max_align_t. over-aligned work goes to the global heap with its alignment
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t))
+    {
+        if (is_oversize(size, align)) {
+            ++oversize_;
+            return ::operator new(size, std::align_val_t{ (std::max)(align, alignof(std::max_align_t)) });
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (!free_) grow();
+        auto* b = free_;
+        free_ = b->next;
+        ++blocks_;
+        return b;
+    }
+    void deallocate(void* ptr, size_t size, size_t align = alignof(std::max_align_t)) noexcept
+    {
+        if (is_oversize(size, align)) {
+            ::operator delete(ptr, std::align_val_t{ (std::max)(align, alignof(std::max_align_t)) });
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto* b = static_cast<block*>(ptr);
+        b->next = free_;
+        free_ = b;
+    }
+    statistics stats() const noexcept
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return { slab_count_, oversize_, blocks_ };
+    }
+private:
+    static constexpr bool is_oversize(size_t size, size_t align) noexcept
+    {
+        return size > block_size || align > alignof(std::max_align_t);
+    }
+    union block {
+        block* next;
+        alignas(std::max_align_t) unsigned char data[block_size];
+    };
+    void grow()
+    {
+        auto* slab = static_cast<block*>(::operator new(sizeof(block) * blocks_per_slab,
+                                                        std::align_val_t{ alignof(std::max_align_t) }));
+        slabs_.push_back(slab);
+        ++slab_count_;
+        for (size_t i = 0; i < blocks_per_slab; ++i) {
+            slab[i].next = free_;
+            free_ = slab + i;
+        }
+    }
+
+    mutable std::mutex mtx_;
+    block* free_ = nullptr;
+    std::vector<block*> slabs_;
+    size_t slab_count_ = 0;
+    size_t blocks_ = 0;
+    std::atomic_size_t oversize_ = 0;
+};
+
+// move only type erased nullary callable.
+// callables up to inline_size bytes are stored in place, larger ones in a work_arena.
+// dispatch goes through a per type table of function pointers instead of a virtual call.
+class work_item {
+public:
+    static constexpr size_t inline_size = 6 * sizeof(void*);
+
+    template<class F>
+    static constexpr bool is_stored_inline =
+        sizeof(F) <= inline_size &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible_v<F>;
+
+    work_item() noexcept = default;
+    template<class F, class ...Args>
+    work_item(std::in_place_type_t<F>, work_arena& arena, Args&& ...args)
+        : ops_{ &ops_for<F> }
+    {
+        static_assert(std::is_invocable_v<F&>);
+        if constexpr (is_stored_inline<F>) {
+            ::new(static_cast<void*>(storage_)) F(std::forward<Args>(args)...);
+        } else {
+            auto* mem = arena.allocate(sizeof(F), alignof(F));
+            try {
+                ::new(static_cast<void*>(storage_)) heap_storage{ ::new(mem) F(std::forward<Args>(args)...), &arena };
+            } catch (...) {
+                arena.deallocate(mem, sizeof(F), alignof(F));
+                throw;
+            }
+        }
+    }
+    work_item(work_item&& other) noexcept
+        : ops_{ other.ops_ }
+    {
+        if (ops_) ops_->relocate(other.storage_, storage_);
+        other.ops_ = nullptr;
+    }
+    work_item& operator=(work_item&& other) noexcept
+    {
+        if (this == &other) return *this;
+        reset();
+        ops_ = other.ops_;
+        if (ops_) ops_->relocate(other.storage_, storage_);
+        other.ops_ = nullptr;
+        return *this;
+    }
+    ~work_item() { reset(); }
+
+    void operator()() { ops_->invoke(storage_); }
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+    void reset() noexcept
+    {
+        if (ops_) ops_->destroy(storage_);
+        ops_ = nullptr;
+    }
+private:
+    struct heap_storage {
+        void* object;
+        work_arena* arena;
+    };
+    struct operations {
+        void (*invoke)(void*);
+        // move from the first argument to the second and destroy the source
+        void (*relocate)(void*, void*) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    template<class F>
+    static F& object(void* storage) noexcept
+    {
+        if constexpr (is_stored_inline<F>)
+            return *std::launder(reinterpret_cast<F*>(storage));
+        else
+            return *static_cast<F*>(reinterpret_cast<heap_storage*>(storage)->object);
+    }
+    template<class F>
+    static constexpr operations ops_for = {
+        [](void* s) { object<F>(s)(); },
+        [](void* from, void* to) noexcept {
+            if constexpr (is_stored_inline<F>) {
+                ::new(to) F(std::move(object<F>(from)));
+                object<F>(from).~F();
+            } else {
+                ::new(to) heap_storage(*reinterpret_cast<heap_storage*>(from));
+            }
+        },
+        [](void* s) noexcept {
+            object<F>(s).~F();
+            if constexpr (!is_stored_inline<F>) {
+                auto* h = reinterpret_cast<heap_storage*>(s);
+                h->arena->deallocate(h->object, sizeof(F), alignof(F));
+            }
+        }
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[inline_size];
+    const operations* ops_ = nullptr;
+};
+
 }
@@ -0,0 +1,218 @@
+﻿#pragma once
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <deque>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <utility>
+
+#include "work.hpp"
+
+namespace ouchi::thread {
+
+// worker index used when the caller is not a worker of the pool
+inline constexpr size_t no_worker = std::numeric_limits<size_t>::max();
+
+// every worker shares one FIFO queue guarded by one mutex.
+class shared_queue {
+public:
+    using work_ptr = work_item;
+
+    explicit shared_queue(size_t) {}
+
+    void push(work_ptr&& w, size_t)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        works_.push(std::move(w));
+    }
+    work_ptr pop(size_t)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (works_.empty()) return {};
+        auto w = std::move(works_.front());
+        works_.pop();
+        return w;
+    }
+    // returns number of discarded work
+    size_t clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        auto cnt = works_.size();
+        std::queue<work_ptr> tmp;
+        works_.swap(tmp);
+        return cnt;
+    }
+private:
+    std::mutex mtx_;
+    std::queue<work_ptr> works_;
+};
+
+// one deque per worker.
+// a worker pushes to and pops from the back of its own deque (newest first),
+// and steals the oldest work from the front of the others when its deque runs dry.
+// work pushed from outside the pool is distributed round robin.
+class work_stealing_queue {
+public:
+    using work_ptr = work_item;
+
+    explicit work_stealing_queue(size_t worker_count)
+        : count_{ std::max<size_t>(worker_count, 1) }
+        , deques_{ std::make_unique<std::unique_ptr<local_deque>[]>(count_) }
+        , next_{ 0 }
+    {
+        for (size_t i = 0; i < count_; ++i) deques_[i] = std::make_unique<local_deque>();
+    }
+
+    // called by the pool on worker thread `worker` before it accepts work.
+    // the deque is reallocated there, so that it is first touched on the worker's numa node.
+    void on_worker_start(size_t worker)
+    {
+        if (worker < count_) deques_[worker] = std::make_unique<local_deque>();
+    }
+
+    void push(work_ptr&& w, size_t worker)
+    {
+        auto& d = *deques_[worker < count_ ? worker : next_++ % count_];
+        std::lock_guard<std::mutex> lock(d.mtx);
+        d.works.push_back(std::move(w));
+    }
+    work_ptr pop(size_t worker)
+    {
+        auto self = worker < count_ ? worker : 0;
+        {
+            auto& d = *deques_[self];
+            std::lock_guard<std::mutex> lock(d.mtx);
+            if (!d.works.empty()) {
+                auto w = std::move(d.works.back());
+                d.works.pop_back();
+                return w;
+            }
+        }
+        for (size_t i = 1; i < count_; ++i) {
+            auto& d = *deques_[(self + i) % count_];
+            std::unique_lock<std::mutex> lock(d.mtx, std::try_to_lock);
+            if (!lock || d.works.empty()) continue;
+            auto w = std::move(d.works.front());
+            d.works.pop_front();
+            deques_[self]->steals.fetch_add(1, std::memory_order_relaxed);
+            return w;
+        }
+        return {};
+    }
+    // number of work worker took from the others
+    size_t steals(size_t worker) const noexcept
+    {
+        return worker < count_ ? deques_[worker]->steals.load(std::memory_order_relaxed) : 0;
+    }
+    size_t clear()
+    {
+        size_t cnt = 0;
+        for (size_t i = 0; i < count_; ++i) {
+            std::lock_guard<std::mutex> lock(deques_[i]->mtx);
+            cnt += deques_[i]->works.size();
+            deques_[i]->works.clear();
+        }
+        return cnt;
+    }
+private:
+    // padded to keep neighbouring deques off the same cache line
+    struct alignas(64) local_deque {
+        std::mutex mtx;
+        std::deque<work_ptr> works;
+        std::atomic_size_t steals = 0;
+    };
+
+    size_t count_;
+    std::unique_ptr<std::unique_ptr<local_deque>[]> deques_;
+    std::atomic_size_t next_;
+};
+
+enum class priority : unsigned {
+    high, normal, low
+};
+
+// strict priority classes. work of a lower class starts only when every higher class is empty.
+// work of the same class is FIFO.
+// keeps queue depth and queueing delay per class.
+class priority_work_queue {
+public:
+    using work_ptr = work_item;
+    using hint_type = priority;
+    using clock = std::chrono::steady_clock;
+    static constexpr size_t level_count = 3;
+
+    struct level_statistics {
+        size_t depth;                       // work currently queued
+        size_t peak_depth;
+        size_t dequeued;                    // work started so far
+        std::chrono::nanoseconds total_wait;
+        std::chrono::nanoseconds max_wait;
+
+        std::chrono::nanoseconds average_wait() const noexcept
+        {
+            if (dequeued == 0) return std::chrono::nanoseconds{ 0 };
+            return total_wait / static_cast<std::chrono::nanoseconds::rep>(dequeued);
+        }
+    };
+
+    explicit priority_work_queue(size_t) {}
+
+    void push(work_ptr&& w, size_t worker)
+    {
+        push(std::move(w), worker, priority::normal);
+    }
+    void push(work_ptr&& w, size_t, priority p)
+    {
+        auto l = std::min<size_t>(static_cast<size_t>(p), level_count - 1);
+        auto now = clock::now();
+        std::lock_guard<std::mutex> lock(mtx_);
+        levels_[l].works.emplace_back(std::move(w), now);
+        auto& st = levels_[l].stats;
+        st.peak_depth = std::max(st.peak_depth, ++st.depth);
+    }
+    work_ptr pop(size_t)
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        for (auto& l : levels_) {
+            if (l.works.empty()) continue;
+            auto [w, pushed] = std::move(l.works.front());
+            l.works.pop_front();
+            auto wait = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - pushed);
+            --l.stats.depth;
+            ++l.stats.dequeued;
+            l.stats.total_wait += wait;
+            l.stats.max_wait = std::max(l.stats.max_wait, wait);
+            return std::move(w);
+        }
+        return {};
+    }
+    size_t clear()
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        size_t cnt = 0;
+        for (auto& l : levels_) {
+            cnt += l.works.size();
+            l.works.clear();
+            l.stats.depth = 0;
+        }
+        return cnt;
+    }
+    level_statistics stats(priority p) const
+    {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return levels_[static_cast<size_t>(p)].stats;
+    }
+private:
+    struct level {
+        std::deque<std::pair<work_ptr, clock::time_point>> works;
+        level_statistics stats{};
+    };
+    mutable std::mutex mtx_;
+    std::array<level, level_count> levels_;
+};
+
+}
@@ -9,7 +9,7 @@ class time_keeper {
 
 	using TimePoint = decltype(Clock::now());
 
-	typename TimePoint m_lastCalled;
+	TimePoint m_lastCalled;
 	typename Clock::duration m_duration;
 
 	typename Clock::duration remaining_time() const {
@@ -19,7 +19,7 @@ class time_keeper {
 public:
 	template<class Duration>
 	time_keeper(Duration d = std::chrono::microseconds(1'000'000) / 60){
-		m_duration = std::chrono::duration_cast<Clock::duration>(d);
+		m_duration = std::chrono::duration_cast<typename Clock::duration>(d);
 	}
 	~time_keeper() = default;
 
@@ -34,6 +34,9 @@ public:
 		if(remaining.count() > 0) std::this_thread::sleep_for(remaining);
 		start();
 	}
+	typename Clock::duration get_duration() const {
+		return m_duration;
+	}
 	template <typename Clock2, typename Period>
 	void set_duration(std::chrono::duration<Clock2, Period> d) {
 		m_duration = std::chrono::duration_cast<decltype(m_duration)>(d);
@@ -1,7 +1,17 @@
 ﻿#include <string>
+#include <cstring>
+#include <cstdint>
 #include "../test.hpp"
 #include "ouchilib/crypto/algorithm/aes.hpp"
 #include "ouchilib/crypto/algorithm/aes_ni.hpp"
+#include "ouchilib/crypto/algorithm/aes_auto.hpp"
+#include "ouchilib/crypto/algorithm/aes_table.hpp"
+#include "ouchilib/crypto/algorithm/aes_bitsliced.hpp"
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#else
+#   include <x86intrin.h>
+#endif
 #include "ouchilib/utl/multiitr.hpp"
 #include "ouchilib/utl/time-measure.hpp"
 
@@ -54,6 +64,140 @@ DEFINE_TEST(test_aes_ni)
         CHECK_EQUAL(a, b);
 }
 
+DEFINE_TEST(test_aes_ni_blocks)
+{
+    constexpr char key[32] = "!!!!!!!!!?!!!!!!!!!!!!!!!!!!!!!";
+    ouchi::crypto::aes256_ni encoder(key);
+    std::uint8_t plain[20 * 16], single[20 * 16], multi[20 * 16];
+    for (auto i = 0u; i < sizeof plain; ++i) plain[i] = (std::uint8_t)(i * 7);
+    // every remainder of the 8 and 4 block paths
+    for (auto n = 1u; n <= 20; ++n) {
+        for (auto i = 0u; i < n; ++i) encoder.encrypt(plain + i * 16, single + i * 16);
+        std::memcpy(multi, plain, n * 16);
+        encoder.encrypt_blocks(multi, multi, n);
+        CHECK_TRUE(std::memcmp(single, multi, n * 16) == 0);
+        encoder.decrypt_blocks(multi, multi, n);
+        CHECK_TRUE(std::memcmp(plain, multi, n * 16) == 0);
+    }
+}
+
+// every backend the cpu supports matches the software implementation
+DEFINE_TEST(test_aes_auto)
+{
+    using namespace ouchi::crypto;
+    constexpr memory_entity<16> key{ "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f" };
+    constexpr memory_entity<16> plain{ "\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\xcc\xdd\xee\xff" };
+    constexpr size_t n = 40;
+    static std::uint8_t data[n * 16], expected[n * 16], buf[n * 16];
+    for (auto i = 0u; i < sizeof data; ++i) data[i] = (std::uint8_t)(i * 13);
+    aes128 reference(key);
+    for (auto i = 0u; i < n; ++i) reference.encrypt(data + i * 16, expected + i * 16);
+
+    for (auto b : { aes_backend::software, aes_backend::ni, aes_backend::vaes, aes_backend::table }) {
+        if (!aes128_auto::supported(b)) {
+            std::printf("aes backend %d is not supported\n", (int)b);
+            continue;
+        }
+        aes128_auto encoder(key, b);
+        CHECK_TRUE(encoder.backend() == b);
+        memory_entity<16> c;
+        encoder.encrypt(plain, c.data);
+        CHECK_EQUAL(c.data[0], 0x69);
+        CHECK_EQUAL(c.data[1], 0xc4);
+        // every remainder of the wide, 8, 4 and 1 block paths
+        for (auto m = 1u; m <= n; ++m) {
+            std::memcpy(buf, data, m * 16);
+            encoder.encrypt_blocks(buf, buf, m);
+            CHECK_TRUE(std::memcmp(buf, expected, m * 16) == 0);
+            encoder.decrypt_blocks(buf, buf, m);
+            CHECK_TRUE(std::memcmp(buf, data, m * 16) == 0);
+        }
+    }
+    CHECK_TRUE(aes128_auto(key).backend() == aes128_auto::best_backend());
+    CHECK_TRUE(aes128_auto::best_backend() != aes_backend::table);
+}
+
+DEFINE_TEST(test_aes_auto_speed)
+{
+    using namespace ouchi::crypto;
+    constexpr char key[32] = "!!!!!!!!!!!!!!!";
+    static std::uint8_t buffer[1 << 20];
+    for (auto b : { aes_backend::software, aes_backend::ni, aes_backend::vaes, aes_backend::table }) {
+        if (!aes256_auto::supported(b)) continue;
+        aes256_auto c(key, b);
+        c.encrypt_blocks(buffer, buffer, sizeof buffer / 16);
+        auto t = ouchi::measure([&c]() { c.encrypt_blocks(buffer, buffer, sizeof buffer / 16); });
+        std::printf("aes256 backend %d : %fMB/s\n", (int)b, (sizeof buffer / (1024.0 * 1024)) / (t.count() / (double)decltype(t)::period::den));
+    }
+}
+
+namespace {
+// fips-197 appendix c
+template<class Aes, size_t KeyLength>
+bool check_fips197(const char* expected)
+{
+    ouchi::crypto::memory_entity<KeyLength> key;
+    for (auto i = 0u; i < KeyLength; ++i) key.data[i] = (std::uint8_t)i;
+    ouchi::crypto::memory_entity<16> plain, c, p;
+    for (auto i = 0u; i < 16; ++i) plain.data[i] = (std::uint8_t)(i * 0x11);
+    Aes encoder(key);
+    encoder.encrypt(plain, c.data);
+    encoder.decrypt(c, p.data);
+    return std::memcmp(c.data, expected, 16) == 0 && plain == p;
+}
+template<template<size_t> class Aes>
+bool check_fips197_all()
+{
+    return check_fips197<Aes<16>, 16>("\x69\xc4\xe0\xd8\x6a\x7b\x04\x30\xd8\xcd\xb7\x80\x70\xb4\xc5\x5a")
+        && check_fips197<Aes<24>, 24>("\xdd\xa9\x7c\xa4\x86\x4c\xdf\xe0\x6e\xaf\x70\xa0\xec\x0d\x71\x91")
+        && check_fips197<Aes<32>, 32>("\x8e\xa2\xb7\xca\x51\x67\x45\xbf\xea\xfc\x49\x90\x4b\x49\x60\x89");
+}
+}
+
+DEFINE_TEST(test_aes_software)
+{
+    using namespace ouchi::crypto;
+    CHECK_TRUE(check_fips197_all<aes>());
+    CHECK_TRUE(check_fips197_all<aes_table>());
+    CHECK_TRUE(check_fips197_all<aes_bitsliced>());
+
+    // multi block bitsliced path against the table implementation
+    constexpr char key[32] = "!!!!!!!!!?!!!!!!!!!!!!!!!!!!!!!";
+    aes256_table table(key);
+    aes256_bitsliced sliced(key);
+    std::uint8_t plain[11 * 16], expected[11 * 16], buf[11 * 16];
+    for (auto i = 0u; i < sizeof plain; ++i) plain[i] = (std::uint8_t)(i * 5 + 1);
+    for (auto i = 0u; i < 11; ++i) table.encrypt(plain + i * 16, expected + i * 16);
+    for (auto n = 1u; n <= 11; ++n) {
+        std::memcpy(buf, plain, n * 16);
+        sliced.encrypt_blocks(buf, buf, n);
+        CHECK_TRUE(std::memcmp(buf, expected, n * 16) == 0);
+        sliced.decrypt_blocks(buf, buf, n);
+        CHECK_TRUE(std::memcmp(buf, plain, n * 16) == 0);
+    }
+}
+
+DEFINE_TEST(test_aes_software_speed)
+{
+    using namespace ouchi::crypto;
+    constexpr char key[16] = "!!!!!!!!!!!!!!!";
+    static std::uint8_t buffer[1 << 16];
+    auto report = [](const char* name, auto&& f) {
+        f();
+        auto start = __rdtsc();
+        auto t = ouchi::measure(f);
+        auto cycles = __rdtsc() - start;
+        std::printf("%-20s %8.2f cycles/byte %10.2fMB/s\n", name, (double)cycles / sizeof buffer,
+                    (sizeof buffer / (1024.0 * 1024)) / (t.count() / (double)decltype(t)::period::den));
+    };
+    aes128 reference(key);
+    aes128_table table(key);
+    aes128_bitsliced sliced(key);
+    report("aes128", [&]() { for (auto i = 0u; i < sizeof buffer; i += 16) reference.encrypt(buffer + i, buffer + i); });
+    report("aes128_table", [&]() { for (auto i = 0u; i < sizeof buffer; i += 16) table.encrypt(buffer + i, buffer + i); });
+    report("aes128_bitsliced", [&]() { sliced.encrypt_blocks(buffer, buffer, sizeof buffer / 16); });
+}
+
 DEFINE_TEST(test_aes_ni_speed)
 {
     static char buffer[8192] = { 1, 2, 3 };
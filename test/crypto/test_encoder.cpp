@@ -1,6 +1,11 @@
 ﻿#include <sstream>
+#include <cstring>
+#include <random>
+#include <vector>
+#include <streambuf>
 #include "../test.hpp"
 #include "ouchilib/crypto/block_encoder.hpp"
+#include "ouchilib/crypto/gcm.hpp"
 #include "ouchilib/crypto/algorithm/aes.hpp"
 #include "ouchilib/crypto/algorithm/aes_ni.hpp"
 #include "ouchilib/utl/time-measure.hpp"
@@ -80,6 +85,227 @@ DEFINE_TEST(test_parallel_encode) {
     }
 }
 
+// parallel functions on a given pool and on the shared one read src and write dest directly
+DEFINE_TEST(test_parallel_pool) {
+    using namespace ouchi::crypto;
+    static std::uint8_t plain[100007];
+    for (auto i : ouchi::step(sizeof plain)) plain[i] = (std::uint8_t)(i * 7);
+    const char key[16] = "!!!!!!!!!!!!!!!";
+    const char iv[16] = "hogehogehogehog";
+    size_t ictr = 3;
+    static std::uint8_t c[2][sizeof plain + 16], d[sizeof plain + 16];
+    ouchi::thread::thread_pool tp(3);
+    auto check = [&](auto make) {
+        auto serial = make(), parallel = make(), shared = make(), dec = make();
+        auto n = serial.encrypt(plain, sizeof plain, c[0], sizeof c[0]);
+        CHECK_EQUAL(parallel.encrypt_parallel(plain, sizeof plain, c[1], sizeof c[1], tp), n);
+        CHECK_TRUE(std::memcmp(c[0], c[1], n) == 0);
+        CHECK_EQUAL(dec.decrypt_parallel(c[1], n, d, sizeof d, tp), sizeof plain);
+        CHECK_TRUE(std::memcmp(plain, d, sizeof plain) == 0);
+        std::memset(c[1], 0, sizeof c[1]);
+        CHECK_EQUAL(shared.encrypt_parallel(plain, sizeof plain, c[1], sizeof c[1]), n);
+        CHECK_TRUE(std::memcmp(c[0], c[1], n) == 0);
+        // 0 and 1 run serially on this thread
+        for (unsigned threads : { 0u, 1u, 3u }) {
+            std::memset(c[1], 0, sizeof c[1]);
+            CHECK_EQUAL(make().encrypt_parallel(plain, sizeof plain, c[1], sizeof c[1], threads), n);
+            CHECK_TRUE(std::memcmp(c[0], c[1], n) == 0);
+            std::memset(d, 0, sizeof d);
+            CHECK_EQUAL(make().decrypt_parallel(c[1], n, d, sizeof d, threads), sizeof plain);
+            CHECK_TRUE(std::memcmp(plain, d, sizeof plain) == 0);
+        }
+    };
+    check([&] { return block_encoder<ecb, aes128_ni>{ std::in_place, key }; });
+    check([&] { return block_encoder<ctr, aes128_ni>{ std::in_place, iv, ictr, key }; });
+    check([&] { return block_encoder<gcm, aes128_ni>{ std::in_place, iv, key }; });
+    // cbc encrypts serially
+    block_encoder<cbc, aes128_ni> enc{ std::in_place, iv, key }, dec{ std::in_place, iv, key };
+    auto n = enc.encrypt(plain, sizeof plain, c[0], sizeof c[0]);
+    CHECK_EQUAL(dec.decrypt_parallel(c[0], n, d, sizeof d, tp), sizeof plain);
+    CHECK_TRUE(std::memcmp(plain, d, sizeof plain) == 0);
+}
+
+// any byte range of a ctr cipher text is decrypted on its own
+DEFINE_TEST(test_ctr_random_access) {
+    using namespace ouchi::crypto;
+    // sp 800-38a f.5.1 on the big endian counter
+    {
+        constexpr memory_entity<16> key{ "\x2b\x7e\x15\x16\x28\xae\xd2\xa6\xab\xf7\x15\x88\x09\xcf\x4f\x3c" };
+        constexpr memory_entity<16> init{ "\xf0\xf1\xf2\xf3\xf4\xf5\xf6\xf7\xf8\xf9\xfa\xfb\xfc\xfd\xfe\xff" };
+        constexpr memory_entity<32> plain{ "\x6b\xc1\xbe\xe2\x2e\x40\x9f\x96\xe9\x3d\x7e\x11\x73\x93\x17\x2a"
+                                           "\xae\x2d\x8a\x57\x1e\x03\xac\x9c\x9e\xb7\x6f\xac\x45\xaf\x8e\x51" };
+        constexpr memory_entity<32> expected{ "\x87\x4d\x61\x91\xb6\x20\xe3\x26\x1b\xef\x68\x64\x99\x0d\xb6\xce"
+                                              "\x98\x06\xf6\x6b\x79\x70\xfd\xff\x86\x17\x18\x7b\xb9\xff\xfd\xff" };
+        ctr<aes128_ni, nonce_add_counter> mode{ std::in_place, init, 0, key };
+        memory_entity<32> c;
+        mode.encrypt_blocks(plain.data, c.data, 2);
+        CHECK_EQUAL(c, expected);
+    }
+    static std::uint8_t plain[10000];
+    for (auto i : ouchi::step(sizeof plain)) plain[i] = (std::uint8_t)(i * 13);
+    const char key[16] = "!!!!!!!!!!!!!!!";
+    const char nonce[16] = "hogehogehogehog";
+    size_t ictr = 5;
+    static std::uint8_t c[sizeof plain + 16];
+    block_encoder<ctr, aes128_ni> enc{ std::in_place, nonce, ictr, key }, dec{ std::in_place, nonce, ictr, key };
+    enc.encrypt(plain, sizeof plain, c, sizeof c);
+    // the default counter is memory_view(nonce) ^ counter
+    aes128_ni a{ key };
+    for (size_t i : { 0, 1, 100, 624 }) {
+        memory_entity<16> stream;
+        a.encrypt(memory_view<16>(nonce) ^ (ictr + i), stream.data);
+        CHECK_EQUAL(stream ^ memory_view<16>(plain + i * 16), memory_entity<16>(c + i * 16));
+    }
+    std::mt19937 mt(2);
+    for (int i = 0; i < 200; ++i) {
+        size_t offset = mt() % sizeof plain;
+        size_t size = mt() % std::min<size_t>(300, sizeof plain - offset + 1);
+        std::uint8_t d[300];
+        dec.decrypt_at(offset, c + offset, size, d);
+        CHECK_TRUE(std::memcmp(d, plain + offset, size) == 0);
+    }
+}
+
+// the multi block path of aes_ni gives the same cipher text as the block by block path of aes
+DEFINE_TEST(test_encoder_blocks) {
+    using namespace ouchi::crypto;
+    static char plain[1000];
+    for (auto i : ouchi::step(sizeof plain)) plain[i] = (char)(i * 31);
+    const char key[16] = "!!!!!!!!!!!!!!!";
+    const char iv[16] = "hogehogehogehog";
+    size_t ictr = 5;
+    char c[2][1008], d[1008];
+    auto check = [&](auto& soft, auto& ni, auto& dec) {
+        CHECK_EQUAL(soft.encrypt(plain, sizeof plain, c[0], sizeof c[0]), 1008);
+        CHECK_EQUAL(ni.encrypt(plain, sizeof plain, c[1], sizeof c[1]), 1008);
+        CHECK_TRUE(std::memcmp(c[0], c[1], 1008) == 0);
+        CHECK_EQUAL(dec.decrypt(c[1], sizeof c[1], d, sizeof d), sizeof plain);
+        CHECK_TRUE(std::memcmp(plain, d, sizeof plain) == 0);
+    };
+    {
+        block_encoder<ecb, aes128> soft{ std::in_place, key };
+        block_encoder<ecb, aes128_ni> ni{ std::in_place, key }, dec{ std::in_place, key };
+        check(soft, ni, dec);
+    }
+    {
+        block_encoder<cbc, aes128> soft{ std::in_place, iv, key };
+        block_encoder<cbc, aes128_ni> ni{ std::in_place, iv, key }, dec{ std::in_place, iv, key };
+        check(soft, ni, dec);
+    }
+    {
+        block_encoder<ctr, aes128> soft{ std::in_place, iv, ictr, key };
+        block_encoder<ctr, aes128_ni> ni{ std::in_place, iv, ictr, key }, dec{ std::in_place, iv, ictr, key };
+        check(soft, ni, dec);
+    }
+}
+
+namespace {
+
+// feeds src in random chunks through update and finalize
+template<class Update, class Finalize>
+std::vector<std::uint8_t> run_chunked(const std::vector<std::uint8_t>& src, std::mt19937& mt, Update update, Finalize finalize)
+{
+    std::vector<std::uint8_t> dest(src.size() + 32);
+    size_t read = 0, written = 0;
+    while (read < src.size()) {
+        auto n = std::min<size_t>(mt() % 70, src.size() - read);
+        written += update(src.data() + read, n, dest.data() + written, n + 15);
+        read += n;
+    }
+    written += finalize(dest.data() + written, 32);
+    dest.resize(written);
+    return dest;
+}
+
+// a stream which can not seek
+struct forward_only_buf : std::streambuf {
+    explicit forward_only_buf(std::string& s) { setg(s.data(), s.data(), s.data() + s.size()); }
+};
+
+}
+
+// update and finalize on random chunks give the same result as the one shot functions
+DEFINE_TEST(test_encoder_update) {
+    using namespace ouchi::crypto;
+    const char key[16] = "!!!!!!!!!!!!!!!";
+    const char iv[16] = "hogehogehogehog";
+    size_t ictr = 5;
+    std::mt19937 mt(1);
+    auto check = [&](auto make) {
+        for (size_t size : { 0, 1, 15, 16, 17, 100, 1000, 1024 }) {
+            std::vector<std::uint8_t> plain(size);
+            plain.reserve(1);  // data() is not null even if empty
+            for (auto& b : plain) b = (std::uint8_t)mt();
+            std::vector<std::uint8_t> expected(size + 32);
+            auto e = make();
+            expected.resize(e.encrypt(plain.data(), size, expected.data(), expected.size()));
+
+            auto enc = make(), dec = make();
+            auto c = run_chunked(plain, mt,
+                                 [&enc](auto... a) { return enc.encrypt_update(a...); },
+                                 [&enc](auto... a) { return enc.encrypt_finalize(a...); });
+            CHECK_TRUE(c == expected);
+            auto d = run_chunked(c, mt,
+                                 [&dec](auto... a) { return dec.decrypt_update(a...); },
+                                 [&dec](auto... a) { return dec.decrypt_finalize(a...); });
+            CHECK_TRUE(d == plain);
+
+            // streams go through the same functions and need no seeking
+            auto ss = make(), sd = make();
+            std::stringstream ps(std::string(plain.begin(), plain.end())), cs;
+            ss.encrypt(ps, cs);
+            auto cstr = cs.str();
+            CHECK_TRUE(cstr == std::string(expected.begin(), expected.end()));
+            forward_only_buf buf(cstr);
+            std::istream is(&buf);
+            std::stringstream ds;
+            sd.decrypt(is, ds);
+            CHECK_TRUE(ds.str() == ps.str());
+        }
+    };
+    check([&] { return block_encoder<ecb, aes128_ni>{ std::in_place, key }; });
+    check([&] { return block_encoder<cbc, aes128_ni>{ std::in_place, iv, key }; });
+    check([&] { return block_encoder<ctr, aes128_ni>{ std::in_place, iv, ictr, key }; });
+    check([&] { return block_encoder<gcm, aes128_ni>{ std::in_place, iv, key }; });
+
+    // the cipher text has to end on a whole block
+    block_encoder<cbc, aes128_ni> dec{ std::in_place, iv, key };
+    std::uint8_t c[20] = {}, d[32];
+    CHECK_EQUAL(dec.decrypt_update(c, sizeof c, d, sizeof d), 16);
+    CHECK_SPECIFIC_EXCEPTION(dec.decrypt_finalize(d, sizeof d), std::runtime_error);
+}
+
+DEFINE_TEST(test_aes_ctr_speed)
+{
+    using namespace ouchi::crypto;
+    static char plain[1 << 20] = { 1, 2, 3 };
+    static char dest[(1 << 20) + 16];
+    constexpr char key[16] = "!!!!!!!!!!!!!!!";
+    constexpr char nonce[16] = "hogehogehogehog";
+    size_t ictr = 0;
+    block_encoder<ctr, aes128_ni> ni{ std::in_place, nonce, ictr, key };
+    ni.encrypt(plain, sizeof plain, dest, sizeof dest);  // touch the pages first
+    auto t = ouchi::measure([&ni]() { ni.encrypt(plain, sizeof plain, dest, sizeof dest); });
+    std::printf("ctr aes128_ni %fMB/s\n", (sizeof plain / (1024.0 * 1024)) / (t.count() / (double)decltype(t)::period::den));
+}
+
+DEFINE_TEST(test_parallel_speed)
+{
+    using namespace ouchi::crypto;
+    constexpr size_t size = 16 << 20;
+    static char plain[size] = { 1, 2, 3 };
+    static char dest[size + 16];
+    constexpr char key[16] = "!!!!!!!!!!!!!!!";
+    constexpr char nonce[16] = "hogehogehogehog";
+    size_t ictr = 0;
+    block_encoder<ctr, aes128_ni> ni{ std::in_place, nonce, ictr, key };
+    ni.encrypt_parallel(plain, size, dest, sizeof dest);  // touch the pages and start the shared pool
+    auto t1 = ouchi::measure([&ni]() { ni.encrypt_parallel(plain, size, dest, sizeof dest, 4u); });
+    auto t2 = ouchi::measure([&ni]() { ni.encrypt_parallel(plain, size, dest, sizeof dest); });
+    auto mbps = [](auto t) { return (size / (1024.0 * 1024)) / (t.count() / (double)decltype(t)::period::den); };
+    std::printf("ctr aes128_ni parallel : new pool %fMB/s, shared pool %fMB/s\n", mbps(t1), mbps(t2));
+}
+
 DEFINE_TEST(test_aes_encode_speed)
 {
     using namespace ouchi::crypto;
@@ -0,0 +1,206 @@
+﻿#include <vector>
+#include <string>
+#include <random>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "../test.hpp"
+#include "ouchilib/crypto/gcm.hpp"
+#include "ouchilib/crypto/block_encoder.hpp"
+#include "ouchilib/crypto/algorithm/aes.hpp"
+#include "ouchilib/crypto/algorithm/aes_ni.hpp"
+#include "ouchilib/crypto/algorithm/aes_auto.hpp"
+#include "ouchilib/utl/time-measure.hpp"
+
+namespace {
+
+std::vector<std::uint8_t> from_hex(const char* hex)
+{
+    std::vector<std::uint8_t> v;
+    v.reserve(1);  // data() is not null even if empty
+    for (; hex[0] && hex[1]; hex += 2) v.push_back((std::uint8_t)std::stoi(std::string(hex, 2), nullptr, 16));
+    return v;
+}
+
+struct gcm_vector {
+    const char* key;
+    const char* iv;
+    const char* plain;
+    const char* aad;
+    const char* crypto;
+    const char* tag;
+};
+
+// test cases 1-4 and 16 of the gcm specification
+constexpr gcm_vector gcm_vectors[] = {
+    { "00000000000000000000000000000000", "000000000000000000000000", "", "", "",
+      "58e2fccefa7e3061367f1d57a4e7455a" },
+    { "00000000000000000000000000000000", "000000000000000000000000", "00000000000000000000000000000000", "",
+      "0388dace60b6a392f328c2b971b2fe78", "ab6e47d42cec13bdf53a67b21257bddf" },
+    { "feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255", "",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+      "4d5c2af327cd64a62cf35abd2ba6fab4" },
+    { "feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+      "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+      "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+      "5bc94fbc3221a5db94fae95ae7121a47" },
+    { "feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308", "cafebabefacedbaddecaf888",
+      "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+      "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+      "522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662",
+      "76fc6ece0f4e1768cddf8853bb2d551b" },
+};
+
+// encrypts and decrypts v, returns whether the cipher text and the tag match
+template<class Algorithm>
+bool check_gcm_vector(const gcm_vector& v)
+{
+    using namespace ouchi::crypto;
+    auto key = from_hex(v.key), iv = from_hex(v.iv), plain = from_hex(v.plain), aad = from_hex(v.aad);
+    auto expected = from_hex(v.crypto), tag = from_hex(v.tag);
+    expected.insert(expected.end(), tag.begin(), tag.end());
+    std::vector<std::uint8_t> c(plain.size() + 16), d(plain.size());
+
+    block_encoder<gcm, Algorithm> enc{ std::in_place, iv.data(), key.data() }, dec{ std::in_place, iv.data(), key.data() };
+    enc.set_aad(aad.data(), aad.size());
+    dec.set_aad(aad.data(), aad.size());
+    if (enc.encrypt(plain.data(), plain.size(), c.data(), c.size()) != c.size() || c != expected) return false;
+    return dec.decrypt(c.data(), c.size(), d.data(), d.size()) == plain.size() && d == plain;
+}
+
+}
+
+DEFINE_TEST(test_ghash)
+{
+    using namespace ouchi::crypto;
+    std::mt19937 mt(1);
+    std::uint8_t h[16], data[40 * 16];
+    for (auto& b : h) b = (std::uint8_t)mt();
+    for (auto& b : data) b = (std::uint8_t)mt();
+
+    // reference, one block at a time on the bit serial multiplication
+    auto hv = detail::load_gf128(h);
+    detail::gf128 x;
+    std::uint8_t expected[16], result[2][16];
+    for (size_t n = 0; n <= 40; ++n) {
+        if (n) {
+            auto c = detail::load_gf128(data + (n - 1) * 16);
+            x = detail::gf128_mul({ x.hi ^ c.hi, x.lo ^ c.lo }, hv);
+        }
+        detail::store_gf128(x, expected);
+        ghash table(h, false), clmul(h, true);
+        table.update(data, n);
+        clmul.update(data, n);
+        table.digest(result[0]);
+        clmul.digest(result[1]);
+        CHECK_TRUE(std::memcmp(expected, result[0], 16) == 0);
+        CHECK_TRUE(std::memcmp(expected, result[1], 16) == 0);
+    }
+    // runs hashed separately give the same hash after shift and merge
+    for (bool use_clmul : { false, true }) {
+        ghash whole(h, use_clmul), first(h, use_clmul), second(h, use_clmul);
+        whole.update(data, 40);
+        first.update(data, 17);
+        second.update(data + 17 * 16, 23);
+        first.shift(23);
+        first.merge(second, 0);
+        whole.digest(result[0]);
+        first.digest(result[1]);
+        CHECK_TRUE(std::memcmp(result[0], result[1], 16) == 0);
+    }
+}
+
+DEFINE_TEST(test_gcm_vectors)
+{
+    using namespace ouchi::crypto;
+    for (size_t i = 0; i < 4; ++i) {
+        CHECK_TRUE(check_gcm_vector<aes128>(gcm_vectors[i]));
+        CHECK_TRUE(check_gcm_vector<aes128_ni>(gcm_vectors[i]));
+        CHECK_TRUE(check_gcm_vector<aes128_auto>(gcm_vectors[i]));
+    }
+    CHECK_TRUE(check_gcm_vector<aes256>(gcm_vectors[4]));
+    CHECK_TRUE(check_gcm_vector<aes256_ni>(gcm_vectors[4]));
+    CHECK_TRUE(check_gcm_vector<aes256_auto>(gcm_vectors[4]));
+}
+
+DEFINE_TEST(test_gcm_parallel)
+{
+    using namespace ouchi::crypto;
+    static std::uint8_t plain[100007];
+    for (auto i : ouchi::step(sizeof plain)) plain[i] = (std::uint8_t)(i * 31);
+    constexpr char key[16] = "!!!!!!!!!!!!!!!";
+    constexpr char iv[12] = "hogehogehog";
+    constexpr char aad[] = "header";
+    static std::uint8_t c[2][sizeof plain + 16], d[sizeof plain];
+
+    block_encoder<gcm, aes128_ni> serial{ std::in_place, iv, key }, parallel{ std::in_place, iv, key };
+    serial.set_aad(aad, sizeof aad);
+    parallel.set_aad(aad, sizeof aad);
+    CHECK_EQUAL(serial.encrypt(plain, sizeof plain, c[0], sizeof c[0]), sizeof c[0]);
+    CHECK_EQUAL(parallel.encrypt_parallel(plain, sizeof plain, c[1], sizeof c[1], 4), sizeof c[1]);
+    CHECK_TRUE(std::memcmp(c[0], c[1], sizeof c[0]) == 0);
+
+    block_encoder<gcm, aes128_ni> dec{ std::in_place, iv, key };
+    dec.set_aad(aad, sizeof aad);
+    CHECK_EQUAL(dec.decrypt_parallel(c[1], sizeof c[1], d, sizeof d, 3), sizeof plain);
+    CHECK_TRUE(std::memcmp(plain, d, sizeof plain) == 0);
+
+    // a flipped bit is detected and no plain text is left behind
+    c[0][12345] ^= 1;
+    block_encoder<gcm, aes128_ni> tampered{ std::in_place, iv, key };
+    tampered.set_aad(aad, sizeof aad);
+    CHECK_SPECIFIC_EXCEPTION(tampered.decrypt(c[0], sizeof c[0], d, sizeof d), std::runtime_error);
+    CHECK_TRUE(std::count(d, d + sizeof d, 0) == sizeof d);
+}
+
+// the tag covers one message. a second one on the same encoder is refused instead of getting a wrong tag
+DEFINE_TEST(test_gcm_two_messages)
+{
+    using namespace ouchi::crypto;
+    constexpr char key[16] = "!!!!!!!!!!!!!!!";
+    constexpr char iv[2][12] = { "hogehogehog", "fugafugafug" };
+    constexpr char plain[2][20] = { "first message", "second message" };
+    std::uint8_t c[2][sizeof plain[0] + 16], d[sizeof plain[0]];
+
+    block_encoder<gcm, aes128> enc{ std::in_place, iv[0], key };
+    CHECK_EQUAL(enc.encrypt(plain[0], sizeof plain[0], c[0], sizeof c[0]), sizeof c[0]);
+    CHECK_SPECIFIC_EXCEPTION(enc.encrypt(plain[1], sizeof plain[1], c[1], sizeof c[1]), std::logic_error);
+    CHECK_SPECIFIC_EXCEPTION(enc.encrypt_update(plain[1], sizeof plain[1], c[1], sizeof c[1]), std::logic_error);
+    CHECK_SPECIFIC_EXCEPTION(enc.set_aad(plain[1], 4), std::logic_error);
+
+    // the second message with its own encoder and iv
+    block_encoder<gcm, aes128> enc2{ std::in_place, iv[1], key };
+    CHECK_EQUAL(enc2.encrypt(plain[1], sizeof plain[1], c[1], sizeof c[1]), sizeof c[1]);
+
+    for (int i = 0; i < 2; ++i) {
+        block_encoder<gcm, aes128> dec{ std::in_place, iv[i], key };
+        CHECK_EQUAL(dec.decrypt(c[i], sizeof c[i], d, sizeof d), sizeof d);
+        CHECK_TRUE(std::memcmp(plain[i], d, sizeof d) == 0);
+        CHECK_SPECIFIC_EXCEPTION(dec.decrypt(c[i], sizeof c[i], d, sizeof d), std::logic_error);
+    }
+    // a failed check ends the message as well
+    c[1][0] ^= 1;
+    block_encoder<gcm, aes128> dec{ std::in_place, iv[1], key };
+    CHECK_SPECIFIC_EXCEPTION(dec.decrypt(c[1], sizeof c[1], d, sizeof d), std::runtime_error);
+    CHECK_SPECIFIC_EXCEPTION(dec.decrypt_finalize(d, sizeof d), std::logic_error);
+}
+
+DEFINE_TEST(test_gcm_speed)
+{
+    using namespace ouchi::crypto;
+    static char plain[1 << 20] = { 1, 2, 3 };
+    static char dest[(1 << 20) + 16];
+    constexpr char key[16] = "!!!!!!!!!!!!!!!";
+    constexpr char iv[12] = "hogehogehog";
+    // an encoder takes one message, so every run gets its own
+    auto run = [](auto make, const char* name) {
+        make().encrypt(plain, sizeof plain, dest, sizeof dest);  // touch the pages first
+        auto encoder = make();
+        auto t = ouchi::measure([&encoder]() { encoder.encrypt(plain, sizeof plain, dest, sizeof dest); });
+        std::printf("%s %fMB/s\n", name, (sizeof plain / (1024.0 * 1024)) / (t.count() / (double)decltype(t)::period::den));
+    };
+    run([&] { return block_encoder<gcm, aes128_ni>{ std::in_place, iv, key }; }, "gcm aes128_ni");
+    run([&] { return block_encoder<gcm, aes128_auto>{ std::in_place, iv, key }; }, "gcm aes128_auto");
+}
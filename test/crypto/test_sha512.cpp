@@ -1,6 +1,12 @@
 ﻿#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstdio>
 #include "../test.hpp"
 #include "ouchilib/crypto/algorithm/sha.hpp"
+#include "ouchilib/utl/time-measure.hpp"
 
 DEFINE_TEST(test_sha512_single_block)
 {
@@ -15,6 +21,17 @@ DEFINE_TEST(test_sha512_2_block)
     CHECK_EQUAL(code[0], 0x8e);
 }
 
+// the upper half of the 128 bit length has to be cleared after earlier blocks
+DEFINE_TEST(test_sha512_long)
+{
+    ouchi::crypto::sha512 hash;
+    hash.update(std::string(1000, 'a'));
+    auto code = hash.finalize();
+    CHECK_EQUAL(code[0], 0x67);
+    CHECK_EQUAL(code[1], 0xba);
+    CHECK_EQUAL(code[63], 0x97);
+}
+
 DEFINE_TEST(test_sha256_single_block)
 {
     using namespace ouchi::literals;
@@ -27,3 +44,84 @@ DEFINE_TEST(test_sha256_2_block)
     auto code = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"_sha256;
     CHECK_EQUAL(code[0], 0x24);
 }
+
+// fragments buffered across update calls must hash the same as whole blocks taken from the message
+DEFINE_TEST(test_sha_update_split)
+{
+    using namespace ouchi::crypto;
+    const std::string million(1000000, 'a');
+    for (auto backend : { sha_backend::scalar, sha_backend::ni }) {
+        if (!sha256::supported(backend)) continue;
+        sha256 whole(backend), split(backend);
+        whole.update(million);
+        for (size_t i = 0; i < million.size(); i += 7) {
+            split.update(std::string_view(million).substr(i, 7));
+        }
+        auto code = whole.finalize();
+        CHECK_EQUAL(code[0], 0xcd);
+        CHECK_EQUAL(code[31], 0xd0);
+        CHECK_TRUE(code == split.finalize());
+    }
+    std::mt19937 mt(11);
+    sha512 whole, split;
+    whole.update(million);
+    for (size_t i = 0; i < million.size();) {
+        auto n = (std::min)(static_cast<size_t>(mt() % 300), million.size() - i);
+        split.update(million.data() + i, n);
+        i += n;
+    }
+    auto code = whole.finalize();
+    CHECK_EQUAL(code[0], 0xe7);
+    CHECK_EQUAL(code[63], 0x9b);
+    CHECK_TRUE(code == split.finalize());
+}
+
+// the sha extensions path must match the portable one for every length and split of the input
+DEFINE_TEST(test_sha256_ni)
+{
+    using namespace ouchi::crypto;
+    if (!sha256::supported(sha_backend::ni)) {
+        std::cout << "sha extensions are not supported. skipped" << std::endl;
+        return;
+    }
+    CHECK_EQUAL(sha256{}.backend(), sha_backend::ni);
+    sha256 abc(sha_backend::ni);
+    abc.update("abc");
+    auto code = abc.finalize();
+    CHECK_EQUAL(code[0], 0xba);
+    CHECK_EQUAL(code[31], 0xad);
+
+    std::mt19937 mt(7);
+    std::vector<std::uint8_t> message(1000);
+    for (auto& b : message) b = static_cast<std::uint8_t>(mt());
+    for (size_t size = 0; size < message.size(); size += (size < 200 ? 1 : 37)) {
+        size_t split = size ? mt() % size : 0;
+        sha256 ni(sha_backend::ni), scalar(sha_backend::scalar);
+        ni.update(message.data(), split);
+        ni.update(message.data() + split, size - split);
+        scalar.update(message.data(), size);
+        CHECK_TRUE(ni.finalize() == scalar.finalize());
+    }
+}
+
+DEFINE_TEST(test_sha256_speed)
+{
+    using namespace ouchi::crypto;
+    std::vector<std::uint8_t> data(16 * 1024 * 1024);
+    for (size_t size = 64; size <= data.size(); size *= 4) {
+        // keep each measurement around 16MiB of input
+        const size_t rep = data.size() / size;
+        for (auto backend : { sha_backend::scalar, sha_backend::ni }) {
+            if (!sha256::supported(backend)) continue;
+            auto t = ouchi::measure([&]() {
+                for (size_t i = 0; i < rep; ++i) {
+                    sha256 hash(backend);
+                    hash.update(data.data(), size);
+                    hash.finalize();
+                }
+            });
+            std::printf("sha256 %s %zuB %fMB/s\n", backend == sha_backend::ni ? "ni" : "scalar", size,
+                        (rep * size / (1024.0 * 1024)) / (t.count() / (double)decltype(t)::period::den));
+        }
+    }
+}
@@ -0,0 +1,92 @@
+﻿#include <vector>
+#include <string_view>
+#include <random>
+#include <cstdio>
+#include <cstdint>
+#include "../test.hpp"
+#include "ouchilib/crypto/algorithm/sha.hpp"
+#include "ouchilib/crypto/algorithm/sha_multi.hpp"
+#include "ouchilib/utl/time-measure.hpp"
+
+namespace {
+
+// messages of every length around the padding boundaries, more than the lanes of any backend
+std::vector<std::vector<std::uint8_t>> make_messages()
+{
+    std::mt19937 mt(3);
+    std::vector<std::vector<std::uint8_t>> messages;
+    for (size_t size = 0; size < 300; size += (size < 140 ? 1 : 7)) {
+        std::vector<std::uint8_t> m(size);
+        m.reserve(1);
+        for (auto& b : m) b = (std::uint8_t)mt();
+        messages.push_back(std::move(m));
+    }
+    messages.emplace_back(5000, 'a');
+    return messages;
+}
+
+// sha_multi<Len> on backend gives the same digests as sha<Len>
+template<int Len>
+bool same_as_sha(const std::vector<std::vector<std::uint8_t>>& messages, ouchi::crypto::sha_multi_backend backend)
+{
+    using namespace ouchi::crypto;
+    std::vector<const void*> ptrs;
+    std::vector<size_t> sizes;
+    for (auto& m : messages) ptrs.push_back(m.data()), sizes.push_back(m.size());
+    std::vector<typename sha_multi<Len>::digest_t> digests(messages.size());
+    sha_multi<Len>::hash(ptrs.data(), sizes.data(), messages.size(), digests.data(), backend);
+    for (size_t i = 0; i < messages.size(); ++i) {
+        sha<Len> s;
+        s.update(messages[i].data(), messages[i].size());
+        if (s.finalize() != digests[i]) return false;
+    }
+    return true;
+}
+
+}
+
+DEFINE_TEST(test_sha_multi)
+{
+    using namespace ouchi::crypto;
+    auto messages = make_messages();
+    for (auto backend : { sha_multi_backend::scalar, sha_multi_backend::avx2, sha_multi_backend::avx512 }) {
+        if (!sha256_multi::supported(backend)) continue;
+        CHECK_TRUE(same_as_sha<256>(messages, backend));
+        CHECK_TRUE(same_as_sha<512>(messages, backend));
+    }
+    // the vectors of test_sha512.cpp
+    std::string_view sv[] = { "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+                              "abcdefghbcdefghicdefghijdefghijkefghijklfghijklmghijklmnhijklmnoijklmnopjklmnopqklmnopqrlmnopqrsmnopqrstnopqrstu" };
+    sha256_multi::digest_t d256[3];
+    sha512_multi::digest_t d512[3];
+    sha256_multi::hash(sv, 3, d256);
+    sha512_multi::hash(sv, 3, d512);
+    CHECK_EQUAL(d256[0][0], 0xba);
+    CHECK_EQUAL(d256[1][0], 0x24);
+    CHECK_EQUAL(d512[0][0], 0xdd);
+    CHECK_EQUAL(d512[2][0], 0x8e);
+}
+
+DEFINE_TEST(test_sha_multi_speed)
+{
+    using namespace ouchi::crypto;
+    constexpr size_t count = 1 << 14, size = 64;
+    static std::uint8_t data[count * size];
+    std::vector<const void*> ptrs(count);
+    std::vector<size_t> sizes(count, size);
+    for (size_t i = 0; i < count; ++i) ptrs[i] = data + i * size;
+    static sha256_multi::digest_t digests256[count];
+    static sha512_multi::digest_t digests512[count];
+    auto run = [&](auto hasher, auto* digests, const char* name) {
+        for (auto backend : { sha_multi_backend::scalar, sha_multi_backend::avx2, sha_multi_backend::avx512 }) {
+            if (!hasher.supported(backend)) continue;
+            auto t = ouchi::measure([&]() {
+                decltype(hasher)::hash(ptrs.data(), sizes.data(), count, digests, backend);
+            });
+            std::printf("%s %zu lanes %fMB/s\n", name, hasher.lanes(backend),
+                        (count * size / (1024.0 * 1024)) / (t.count() / (double)decltype(t)::period::den));
+        }
+    };
+    run(sha256_multi{}, digests256, "sha256_multi 64B messages");
+    run(sha512_multi{}, digests512, "sha512_multi 64B messages");
+}
@@ -0,0 +1,82 @@
+﻿#include "ouchilib/thread/tasksystem.hpp"
+#include "../test.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+// this file replaces the global allocator, so it is built into its own executable (test/allocation)
+
+using namespace ouchi::thread;
+
+namespace {
+// allocations made through the replaceable allocation functions in this program
+std::atomic_size_t allocation_count = 0;
+
+void* allocate(std::size_t size, std::size_t align) noexcept
+{
+    ++allocation_count;
+    if (align <= alignof(std::max_align_t)) return std::malloc(size ? size : 1);
+    // the block returned by malloc is kept just before the aligned pointer
+    auto* raw = static_cast<char*>(std::malloc(size + align + sizeof(void*)));
+    if (!raw) return nullptr;
+    auto addr = reinterpret_cast<std::uintptr_t>(raw + sizeof(void*));
+    auto* p = reinterpret_cast<char*>((addr + align - 1) & ~(std::uintptr_t(align) - 1));
+    reinterpret_cast<void**>(p)[-1] = raw;
+    return p;
+}
+void deallocate(void* p, std::size_t align) noexcept
+{
+    if (!p) return;
+    if (align <= alignof(std::max_align_t)) std::free(p);
+    else std::free(static_cast<void**>(p)[-1]);
+}
+void* allocate_or_throw(std::size_t size, std::size_t align)
+{
+    if (auto* p = allocate(size, align)) return p;
+    throw std::bad_alloc();
+}
+}
+
+void* operator new(std::size_t size) { return allocate_or_throw(size, alignof(std::max_align_t)); }
+void* operator new[](std::size_t size) { return allocate_or_throw(size, alignof(std::max_align_t)); }
+void* operator new(std::size_t size, std::align_val_t al) { return allocate_or_throw(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al) { return allocate_or_throw(size, std::size_t(al)); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return allocate(size, alignof(std::max_align_t)); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return allocate(size, alignof(std::max_align_t)); }
+void* operator new(std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return allocate(size, std::size_t(al)); }
+void* operator new[](std::size_t size, std::align_val_t al, const std::nothrow_t&) noexcept { return allocate(size, std::size_t(al)); }
+
+void operator delete(void* p) noexcept { deallocate(p, alignof(std::max_align_t)); }
+void operator delete[](void* p) noexcept { deallocate(p, alignof(std::max_align_t)); }
+void operator delete(void* p, std::size_t) noexcept { deallocate(p, alignof(std::max_align_t)); }
+void operator delete[](void* p, std::size_t) noexcept { deallocate(p, alignof(std::max_align_t)); }
+void operator delete(void* p, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete[](void* p, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete(void* p, std::size_t, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete[](void* p, std::size_t, std::align_val_t al) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { deallocate(p, alignof(std::max_align_t)); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { deallocate(p, alignof(std::max_align_t)); }
+void operator delete(void* p, std::align_val_t al, const std::nothrow_t&) noexcept { deallocate(p, std::size_t(al)); }
+void operator delete[](void* p, std::align_val_t al, const std::nothrow_t&) noexcept { deallocate(p, std::size_t(al)); }
+
+// a frozen graph is relaunched without allocating.
+// run on the calling thread, since the queue of a thread pool allocates for itself
+DEFINE_TEST(task_frozen_graph_allocation_test)
+{
+    int sum = 0;
+    tasksystem ts;
+    auto& a = ts.create_task([&sum]() { ++sum; });
+    auto& b = ts.create_task([&sum]() { ++sum; });
+    auto& c = ts.create_task([&sum]() { ++sum; });
+    auto& d = ts.create_task([&sum]() { ++sum; });
+    a.before(b).before(c);
+    d.after(b).after(c);
+    ts.freeze();
+    ts.launch();
+    auto before = allocation_count.load();
+    for (int i = 0; i < 100; ++i) ts.launch();
+    CHECK_EQUAL(allocation_count.load(), before);
+    CHECK_EQUAL(sum, 404);
+}
@@ -9,6 +9,13 @@
 #include <atomic>
 #include <sstream>
 #include <chrono>
+#include <vector>
+#include <stdexcept>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <algorithm>
+#include <thread>
 
 using namespace ouchi::thread;
 
@@ -56,3 +63,235 @@ DEFINE_TEST(task_paralel_test)
     std::cout << sa.str() << '\n';
 }
 
+
+DEFINE_TEST(task_dag_test)
+{
+    // layered graph: every task of layer n runs after every task of layer n-1
+    constexpr int layers = 6, width = 8;
+    thread_pool tp(4);
+    tasksystem ts(tp);
+    std::atomic_int finished_layer[layers] = {};
+    std::atomic_bool ok = true;
+    std::vector<task_base*> prev;
+    for (int l = 0; l < layers; ++l) {
+        std::vector<task_base*> cur;
+        for (int w = 0; w < width; ++w) {
+            auto& t = ts.create_task([l, &finished_layer, &ok]() {
+                if (l > 0 && finished_layer[l - 1] != width) ok = false;
+                ++finished_layer[l];
+            });
+            for (auto* p : prev) t.after(*p);
+            cur.push_back(&t);
+        }
+        prev = std::move(cur);
+    }
+    ts.launch();
+    CHECK_TRUE(ok);
+    CHECK_EQUAL(finished_layer[layers - 1], width);
+}
+
+DEFINE_TEST(task_cycle_test)
+{
+    tasksystem ts;
+    auto& a = ts.create_task([]() {});
+    auto& b = ts.create_task([]() {});
+    ts.create_task([]() {});
+    a.before(b);
+    b.before(a);
+    CHECK_SPECIFIC_EXCEPTION(ts.launch(2), std::logic_error);
+}
+
+DEFINE_TEST(task_frozen_graph_test)
+{
+    std::stringstream ss;
+    int sum = 0;
+    tasksystem ts;
+    auto& a = ts.create_task([&ss]() { ss << 'a'; });
+    auto& b = ts.create_task([&ss]() { ss << 'b'; });
+    auto& c = ts.create_task([&ss, &sum]() { ss << 'c'; ++sum; });
+    c.after(b);
+    b.after(a);
+    ts.freeze();
+    CHECK_TRUE(ts.frozen());
+    for (auto i = 0; i < 3; ++i) {
+        ts.launch(i % 2 ? 2 : 0);
+        CHECK_EQUAL(ss.str(), "abc");
+        CHECK_EQUAL(ts.last_launch().tasks, 3);
+        CHECK_EQUAL(ts.last_launch().threads, i % 2 ? 2 : 0);
+        ss.str("");
+    }
+    CHECK_EQUAL(sum, 3);
+
+    // new tasks are not part of the frozen graph
+    ts.create_task([&sum]() { sum += 100; });
+    ts.launch();
+    CHECK_EQUAL(sum, 4);
+    ts.unfreeze();
+    ts.launch();
+    CHECK_EQUAL(sum, 104);
+}
+
+// an edge from a task added after freeze() into a frozen task is ignored like the task
+DEFINE_TEST(task_frozen_graph_new_edge_test)
+{
+    for (size_t threads : {0, 2}) {
+        int count = 0;
+        tasksystem ts;
+        auto& a = ts.create_task([&count]() { ++count; });
+        ts.freeze();
+        auto& b = ts.create_task([]() {});
+        b.before(a);
+        ts.launch(threads);
+        CHECK_EQUAL(count, 1);
+        CHECK_TRUE(a.get_status() == task_base::status::completed);
+        CHECK_TRUE(b.get_status() == task_base::status::waiting);
+    }
+}
+
+DEFINE_TEST(task_data_passing_test)
+{
+    for (size_t threads : {0, 2}) {
+        tasksystem ts;
+        auto& a = ts.create_task([]() { return 21; });
+        auto& b = ts.create_task([]() { return std::string("x"); });
+        auto& c = ts.create_task([](int n, std::string s) { return s + std::to_string(n * 2); }, a, b);
+        auto& p = ts.create_task([]() { return std::make_unique<int>(7); });
+        auto& q = ts.create_task([](std::unique_ptr<int> v, int n) { return *v + n; }, p, a);
+        std::string out;
+        ts.create_task([&out](std::string s, int v) { out = s + ':' + std::to_string(v); }, c, q);
+        ts.launch(threads);
+        CHECK_EQUAL(out, "x42:28");
+        CHECK_EQUAL(a.get(), 21);
+    }
+    // failure of a producer fails its consumers
+    tasksystem ts;
+    auto& a = ts.create_task([]() -> int { throw 0; });
+    auto& b = ts.create_task([](int n) { return n; }, a);
+    ts.launch();
+    CHECK_TRUE(b.get_status() == task_base::status::failed);
+}
+
+DEFINE_TEST(task_cancel_test)
+{
+    using status = task_base::status;
+    // a failure cancels what depends on it, and nothing else
+    {
+        tasksystem ts;
+        ts.set_failure_policy(tasksystem::failure_policy::cancel_dependents);
+        std::atomic_int ran = 0;
+        auto& a = ts.create_task([]() { throw std::runtime_error("a"); });
+        auto& b = ts.create_task([&ran]() { ++ran; });
+        auto& c = ts.create_task([&ran]() { ++ran; });
+        auto& d = ts.create_task([&ran]() { ++ran; });
+        b.after(a);
+        c.after(b);
+        d.after(c);
+        auto& e = ts.create_task([&ran]() { ++ran; });
+        d.after(e);
+        auto& f = ts.create_task([&ran]() { ++ran; });
+        ts.launch(2);
+        CHECK_EQUAL(ran, 2);
+        CHECK_TRUE(a.get_status() == status::failed);
+        CHECK_TRUE(b.get_status() == status::cancelled);
+        CHECK_TRUE(d.get_status() == status::cancelled);
+        CHECK_TRUE(e.get_status() == status::completed && f.get_status() == status::completed);
+    }
+    // a failure stops the whole launch, including the retries of a failable task
+    {
+        tasksystem ts;
+        ts.set_failure_policy(tasksystem::failure_policy::cancel_all);
+        std::atomic_int tries = 0;
+        auto& a = ts.create_task([]() { throw std::runtime_error("a"); });
+        auto& flaky = ts.create_task([&tries](std::stop_token) { ++tries; throw 0; }, retry_on_fail{ 1000 });
+        flaky.after(a);
+        auto& later = ts.create_task([]() {});
+        later.after(flaky);
+        ts.launch();
+        CHECK_EQUAL(tries, 0);
+        CHECK_TRUE(later.get_status() == status::cancelled);
+    }
+    // cancel() from a task signals the token of running tasks
+    {
+        tasksystem ts;
+        std::atomic_bool stopped = false;
+        auto& worker = ts.create_task([&stopped](std::stop_token token) {
+            while (!token.stop_requested()) std::this_thread::yield();
+            stopped = true;
+        });
+        ts.create_task([&ts]() { ts.cancel(); });
+        auto& value = ts.create_task([](std::stop_token token) { return token.stop_possible() ? 1 : 0; });
+        ts.launch(2);
+        CHECK_TRUE(stopped);
+        CHECK_TRUE(worker.get_status() == status::completed);
+        CHECK_TRUE(value.done());
+    }
+}
+
+DEFINE_TEST(task_retry_backoff_test)
+{
+    using namespace std::chrono_literals;
+    using status = task_base::status;
+    backoff b{ 2ms, 20ms, 2.0, 0.0 };
+    std::minstd_rand g;
+    CHECK_TRUE(b.delay(0, g) == 2ms && b.delay(2, g) == 8ms && b.delay(10, g) == 20ms);
+    b.jitter = 1.0;
+    auto jittered = b.delay(1, g);
+    CHECK_TRUE(jittered >= 0ms && jittered <= 4ms);
+
+    // the worker is free for other tasks while a retry waits
+    for (size_t threads : { 0, 1 }) {
+        tasksystem ts;
+        std::mutex mtx;
+        std::vector<std::string> order;
+        auto record = [&](const char* s) { std::lock_guard lock(mtx); order.push_back(s); };
+        int attempts = 0;
+        ts.create_task([&]() {
+            record("flaky");
+            if (++attempts < 3) throw std::runtime_error("flaky");
+        }, retry_on_fail{ 5, backoff{ 5ms, 5ms, 1.0, 0.0 } });
+        ts.create_task([&]() { record("other"); });
+        auto start = std::chrono::steady_clock::now();
+        ts.launch(threads);
+        CHECK_TRUE(std::chrono::steady_clock::now() - start >= 10ms);
+        CHECK_EQUAL(attempts, 3);
+        CHECK_EQUAL(order.size(), 4);
+        CHECK_EQUAL(order.back(), "flaky");
+        CHECK_TRUE(std::find(order.begin(), order.end(), "other") - order.begin() < 2);
+    }
+
+    // gives up after the retries, and cancel() ends a pending retry at once
+    {
+        tasksystem ts;
+        int attempts = 0;
+        auto& t = ts.create_task([&attempts]() { ++attempts; throw 0; }, retry_on_fail{ 2, backoff{ 1ms } });
+        ts.launch(2);
+        CHECK_EQUAL(attempts, 3);
+        CHECK_TRUE(t.get_status() == status::failed);
+
+        int slow_attempts = 0;
+        ts.create_task([&ts]() { std::this_thread::sleep_for(5ms); ts.cancel(); });
+        auto& slow = ts.create_task([&slow_attempts]() { ++slow_attempts; throw 0; }, retry_on_fail{ 5, backoff{ 10s } });
+        auto start = std::chrono::steady_clock::now();
+        ts.launch(2);
+        CHECK_TRUE(std::chrono::steady_clock::now() - start < 5s);
+        CHECK_EQUAL(slow_attempts, 1);
+        CHECK_TRUE(slow.get_status() == status::cancelled);
+    }
+
+    // cancel() from another thread ends a pending retry of the inline launch
+    {
+        tasksystem ts;
+        std::atomic_bool tried = false;
+        auto& slow = ts.create_task([&tried]() { tried = true; throw 0; }, retry_on_fail{ 5, backoff{ 10s } });
+        std::thread canceller([&]() {
+            while (!tried) std::this_thread::yield();
+            std::this_thread::sleep_for(5ms);
+            ts.cancel();
+        });
+        auto start = std::chrono::steady_clock::now();
+        ts.launch();
+        canceller.join();
+        CHECK_TRUE(std::chrono::steady_clock::now() - start < 5s);
+        CHECK_TRUE(slow.get_status() == status::cancelled);
+    }
+}
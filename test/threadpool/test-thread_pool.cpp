@@ -1,6 +1,15 @@
 ﻿#include "../test.hpp"
 #include "ouchilib/thread/thread-pool.hpp"
+#include "ouchilib/thread/affinity.hpp"
 #include "ouchilib/utl/time-measure.hpp"
+#include <atomic>
+#include <vector>
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+#include <array>
+#include <cstdint>
+#include <mutex>
 
 DEFINE_TEST(test_thread_pool)
 {
@@ -22,3 +31,294 @@ DEFINE_TEST(test_thread_pool)
         }
     }
 }
+
+DEFINE_TEST(test_work_stealing_pool)
+{
+    constexpr unsigned c = 64;
+    std::atomic_uint sum = 0;
+    {
+        ouchi::thread::work_stealing_pool tp(4);
+        for (auto i = 0u; i < c; ++i) {
+            // work pushed from a worker goes to its own deque
+            tp.push([i, &sum, &tp]() {
+                tp.push([i, &sum]() { sum += i; });
+            });
+        }
+        tp.wait();
+        CHECK_EQUAL(tp.remaining(), 0);
+    }
+    CHECK_EQUAL(sum, c * (c - 1) / 2);
+}
+
+template<class Pool>
+std::chrono::nanoseconds fine_grained_jobs(unsigned producers, unsigned jobs)
+{
+    std::atomic_uint cnt = 0;
+    Pool tp(4);
+    auto t = ouchi::measure<std::chrono::steady_clock, std::chrono::nanoseconds>([&]() {
+        std::vector<std::thread> th;
+        for (auto p = 0u; p < producers; ++p) {
+            th.emplace_back([&]() {
+                for (auto i = 0u; i < jobs; ++i)
+                    tp.push([&cnt]() { ++cnt; });
+            });
+        }
+        for (auto& i : th) i.join();
+        tp.wait();
+    });
+    return cnt == producers * jobs ? t : std::chrono::nanoseconds::max();
+}
+
+DEFINE_TEST(test_work_stealing_pool_speed)
+{
+    constexpr unsigned producers = 4;
+    constexpr unsigned jobs = 20000;
+    auto shared = fine_grained_jobs<ouchi::thread::thread_pool>(producers, jobs);
+    auto stealing = fine_grained_jobs<ouchi::thread::work_stealing_pool>(producers, jobs);
+    CHECK_TRUE(shared != std::chrono::nanoseconds::max());
+    CHECK_TRUE(stealing != std::chrono::nanoseconds::max());
+    std::printf("thread_pool %f ms, work_stealing_pool %f ms (%u jobs)\n",
+                shared.count() / 1e6, stealing.count() / 1e6, producers * jobs);
+}
+
+DEFINE_TEST(test_thread_pool_submit)
+{
+    using namespace std::chrono_literals;
+    ouchi::thread::thread_pool tp(2);
+    auto a = tp.submit([]() { return 1; });
+    auto b = tp.submit([]() -> std::string { throw std::runtime_error("b"); });
+    auto c = tp.submit([]() { std::this_thread::sleep_for(50ms); });
+    CHECK_EQUAL(a.get(), 1);
+    CHECK_SPECIFIC_EXCEPTION(b.get(), std::runtime_error);
+    CHECK_TRUE(!tp.wait_for(1ms) || c.wait_for(0s) == std::future_status::ready);
+    tp.wait();
+    CHECK_TRUE(c.wait_for(0s) == std::future_status::ready);
+    CHECK_TRUE(tp.wait_for(0s));
+}
+
+namespace {
+std::atomic_int function_calls = 0;
+void count_call() { ++function_calls; }
+}
+
+// a function lvalue is stored as a function pointer
+DEFINE_TEST(test_thread_pool_push_function)
+{
+    ouchi::thread::thread_pool tp(2);
+    tp.push(count_call);
+    tp.push(&count_call);
+    auto f = tp.submit(count_call);
+    f.get();
+    tp.wait();
+    CHECK_EQUAL(function_calls.load(), 3);
+}
+
+DEFINE_TEST(test_work_item_storage)
+{
+    struct counted : ouchi::thread::work_base {
+        int* p;
+        explicit counted(int* ptr) : p{ ptr } {}
+        void operator()() override { ++*p; }
+    };
+    int cnt = 0;
+    std::array<int, 32> big{};
+    big[31] = 1;
+    ouchi::thread::work_arena arena;
+    {
+        ouchi::thread::work_item small(std::in_place_type<counted>, arena, &cnt);
+        auto large_fn = [big, &cnt]() { cnt += big[31]; };
+        ouchi::thread::work_item large(std::in_place_type<decltype(large_fn)>, arena, large_fn);
+        ouchi::thread::work_item moved = std::move(large);
+        CHECK_TRUE(!large);
+        small();
+        moved();
+        CHECK_EQUAL(cnt, 2);
+    }
+    auto s = arena.stats();
+    CHECK_EQUAL(s.block_allocations, 1);
+    CHECK_EQUAL(s.slab_allocations, 1);
+    CHECK_EQUAL(s.oversize_allocations, 0);
+
+    // aligned beyond the arena blocks, so it is allocated with its own alignment
+    struct alignas(128) aligned_work {
+        int* p;
+        void operator()() { *p += reinterpret_cast<std::uintptr_t>(this) % alignof(aligned_work) == 0; }
+    };
+    {
+        ouchi::thread::work_item aligned(std::in_place_type<aligned_work>, arena, aligned_work{ &cnt });
+        ouchi::thread::work_item moved = std::move(aligned);
+        moved();
+        CHECK_EQUAL(cnt, 3);
+    }
+    CHECK_EQUAL(arena.stats().oversize_allocations, 1);
+}
+
+DEFINE_TEST(test_small_work_speed)
+{
+    constexpr unsigned jobs = 100000;
+    std::atomic_uint cnt = 0;
+    std::array<unsigned, 32> payload{};
+    payload[0] = 1;
+    ouchi::thread::thread_pool tp(4);
+    auto small = ouchi::measure<std::chrono::steady_clock, std::chrono::nanoseconds>([&]() {
+        for (auto i = 0u; i < jobs; ++i)
+            tp.push([&cnt]() { ++cnt; });
+        tp.wait();
+    });
+    auto after_small = tp.arena_stats();
+    auto large = ouchi::measure<std::chrono::steady_clock, std::chrono::nanoseconds>([&]() {
+        for (auto i = 0u; i < jobs; ++i)
+            tp.push([&cnt, payload]() { cnt += payload[0]; });
+        tp.wait();
+    });
+    auto after_large = tp.arena_stats();
+    CHECK_EQUAL(cnt, 2 * jobs);
+    CHECK_EQUAL(after_small.block_allocations, 0);
+    CHECK_EQUAL(after_large.block_allocations, jobs);
+    CHECK_EQUAL(after_large.oversize_allocations, 0);
+    std::printf("inline work: %f Mjobs/s, %zu heap allocations\n"
+                "arena work: %f Mjobs/s, %zu heap allocations (slabs)\n",
+                jobs * 1e3 / small.count(), after_small.slab_allocations,
+                jobs * 1e3 / large.count(), after_large.slab_allocations);
+}
+
+DEFINE_TEST(test_priority_thread_pool)
+{
+    using namespace std::chrono_literals;
+    using ouchi::thread::priority;
+    std::vector<int> order;
+    std::mutex mtx;
+    {
+        ouchi::thread::priority_thread_pool tp(1);
+        tp.pause();
+        auto record = [&order, &mtx](int i) {
+            return [i, &order, &mtx]() { std::lock_guard lock(mtx); order.push_back(i); };
+        };
+        tp.push(record(2), priority::low);
+        tp.push(record(1));
+        tp.push(record(0), priority::high);
+        tp.push(record(3), priority::low);
+        tp.resume();
+        tp.wait();
+    }
+    CHECK_TRUE((order == std::vector<int>{0, 1, 2, 3}));
+}
+
+DEFINE_TEST(test_priority_thread_pool_latency)
+{
+    using namespace std::chrono_literals;
+    using ouchi::thread::priority;
+    ouchi::thread::priority_thread_pool tp(1);
+    // bulk work queued ahead of latency sensitive work
+    tp.pause();
+    for (auto i = 0; i < 100; ++i)
+        tp.push([]() { std::this_thread::sleep_for(100us); }, priority::low);
+    tp.resume();
+    for (auto i = 0; i < 10; ++i) {
+        (void)tp.submit([]() {}, priority::high);
+        std::this_thread::sleep_for(200us);
+    }
+    tp.wait();
+    auto high = tp.queue().stats(priority::high);
+    auto low = tp.queue().stats(priority::low);
+    CHECK_EQUAL(high.dequeued, 10);
+    CHECK_EQUAL(low.peak_depth, 100);
+    CHECK_EQUAL(low.depth, 0);
+    CHECK_TRUE(high.average_wait() < low.average_wait());
+    std::printf("average wait high %lld us, low %lld us. max wait high %lld us, low %lld us\n",
+                (long long)high.average_wait().count() / 1000, (long long)low.average_wait().count() / 1000,
+                (long long)high.max_wait.count() / 1000, (long long)low.max_wait.count() / 1000);
+}
+
+DEFINE_TEST(test_thread_pool_placement)
+{
+    namespace th = ouchi::thread;
+    CHECK_TRUE((th::detail::parse_cpulist("0-2,5,7-8\n") == std::vector<unsigned>{0, 1, 2, 5, 7, 8}));
+    // sparse node ids as in /sys/devices/system/node/online
+    CHECK_TRUE((th::detail::parse_cpulist("0,2") == std::vector<unsigned>{0, 2}));
+    auto nodes = th::numa_nodes();
+    CHECK_TRUE(!nodes.empty() && !nodes.front().empty());
+    auto allowed = th::get_current_thread_affinity();
+    CHECK_TRUE(!allowed.empty());
+    if (allowed.empty()) return;
+
+    th::pool_options options;
+    options.thread_count = 3;
+    options.name = "pinned";
+    options.cpus = { allowed.front() };
+    std::vector<std::vector<unsigned>> seen(options.thread_count);
+    {
+        th::work_stealing_pool tp(options);
+        CHECK_EQUAL(tp.size(), 3);
+        for (size_t i = 0; i < 30; ++i)
+            tp.push([&seen, i]() { if (i < 3) seen[i] = th::get_current_thread_affinity(); });
+        tp.wait();
+    }
+    for (auto& s : seen) CHECK_TRUE((s == std::vector<unsigned>{ allowed.front() }));
+
+    th::pool_options spread;
+    spread.thread_count = 2;
+    spread.spread_numa_nodes = true;
+    std::atomic_int sum = 0;
+    {
+        th::work_stealing_pool tp(spread);
+        for (auto i = 0; i < 100; ++i) tp.push([&sum, i]() { sum += i; });
+        tp.wait();
+    }
+    CHECK_EQUAL(sum, 4950);
+}
+
+DEFINE_TEST(test_thread_pool_statistics)
+{
+    using namespace std::chrono_literals;
+    namespace th = ouchi::thread;
+    static_assert(sizeof(th::thread_pool) < sizeof(th::instrumented_thread_pool<>));
+    th::instrumented_thread_pool<th::work_stealing_queue> tp(2);
+    tp.pause();
+    for (auto i = 0; i < 20; ++i) tp.push([]() { std::this_thread::sleep_for(200us); });
+    tp.resume();
+    tp.wait();
+    auto s = tp.statistics();
+    CHECK_EQUAL(s.submitted, 20);
+    CHECK_EQUAL(s.peak_depth, 20);
+    CHECK_EQUAL(s.run.count, 20);
+    CHECK_EQUAL(s.wait.count, 20);
+    CHECK_TRUE(s.run.mean() >= 200us);
+    CHECK_TRUE(s.run.percentile(0.5) >= 200us && s.run.percentile(0.5) <= s.run.max);
+    CHECK_EQUAL(s.workers.size(), 2);
+    size_t executed = 0;
+    for (auto& w : s.workers) {
+        executed += w.executed;
+        CHECK_TRUE(w.utilization() >= 0.0 && w.utilization() <= 1.0);
+    }
+    CHECK_EQUAL(executed, 20);
+    std::printf("wait mean %lld us p99 %lld us, run mean %lld us, steals %zu + %zu, utilization %.2f %.2f\n",
+                (long long)s.wait.mean().count() / 1000, (long long)s.wait.percentile(0.99).count() / 1000,
+                (long long)s.run.mean().count() / 1000, s.workers[0].steals, s.workers[1].steals,
+                s.workers[0].utilization(), s.workers[1].utilization());
+}
+
+DEFINE_TEST(test_thread_pool_cancel)
+{
+    using namespace std::chrono_literals;
+    ouchi::thread::thread_pool tp(1);
+    std::atomic_int started = 0, finished = 0;
+    auto first = tp.submit([&started](std::stop_token token) {
+        ++started;
+        while (!token.stop_requested()) std::this_thread::sleep_for(1ms);
+        return 1;
+    });
+    for (auto i = 0; i < 10; ++i) tp.push([&finished]() { ++finished; });
+    while (!started) std::this_thread::yield();
+    CHECK_TRUE(!tp.shutdown(10ms));
+    CHECK_EQUAL(first.get(), 1);
+    tp.wait();
+    CHECK_EQUAL(finished, 0);
+
+    // the pool keeps working with a fresh token
+    auto second = tp.submit([](std::stop_token token) { return token.stop_requested(); });
+    CHECK_TRUE(!second.get());
+    tp.push([&finished]() { ++finished; });
+    CHECK_TRUE(tp.shutdown(1s));
+    CHECK_EQUAL(finished, 1);
+}
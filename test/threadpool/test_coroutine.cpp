@@ -0,0 +1,81 @@
+﻿#include "../test.hpp"
+#include "ouchilib/thread/thread-pool.hpp"
+#include "ouchilib/thread/coroutine.hpp"
+#include <vector>
+#include <thread>
+#include <stdexcept>
+#include <string>
+#include <memory>
+
+using namespace ouchi::thread;
+
+namespace {
+
+co_task<int> square_on(thread_pool& tp, int i, std::thread::id caller, bool& moved)
+{
+    co_await schedule(tp);
+    moved = std::this_thread::get_id() != caller;
+    co_return i * i;
+}
+
+co_task<void> fail_on(thread_pool& tp)
+{
+    co_await schedule(tp);
+    throw std::runtime_error("fail");
+}
+
+co_task<std::string> concat(co_task<int> a, co_task<int> b)
+{
+    auto x = co_await a;
+    auto y = co_await b;
+    co_return std::to_string(x) + std::to_string(y);
+}
+
+}
+
+DEFINE_TEST(test_coroutine_schedule)
+{
+    thread_pool tp(2);
+    bool moved = false;
+    CHECK_EQUAL(sync_wait(square_on(tp, 7, std::this_thread::get_id(), moved)), 49);
+    CHECK_TRUE(moved);
+
+    bool m1 = false, m2 = false;
+    CHECK_EQUAL(sync_wait(concat(square_on(tp, 2, {}, m1), square_on(tp, 3, {}, m2))), "49");
+    CHECK_THROW(sync_wait(fail_on(tp)));
+}
+
+DEFINE_TEST(test_coroutine_when_all)
+{
+    thread_pool tp(3);
+    bool moved[3] = {};
+    auto [a, b, c] = sync_wait(when_all(square_on(tp, 1, {}, moved[0]),
+                                        square_on(tp, 2, {}, moved[1]),
+                                        [](thread_pool& tp) -> co_task<void> { co_await schedule(tp); }(tp)));
+    CHECK_EQUAL(a, 1);
+    CHECK_EQUAL(b, 4);
+    (void)c;
+
+    auto flags = std::make_unique<bool[]>(100);
+    std::vector<co_task<int>> tasks;
+    for (auto i = 0; i < 100; ++i) tasks.push_back(square_on(tp, i, {}, flags[i]));
+    auto squares = sync_wait(when_all(std::move(tasks)));
+    bool ok = squares.size() == 100;
+    for (auto i = 0; i < 100 && ok; ++i) ok &= squares[i] == i * i;
+    CHECK_TRUE(ok);
+
+    std::vector<co_task<void>> failing;
+    failing.push_back(fail_on(tp));
+    failing.push_back([](thread_pool& tp) -> co_task<void> { co_await schedule(tp); }(tp));
+    CHECK_THROW(sync_wait(when_all(std::move(failing))));
+}
+
+DEFINE_TEST(test_coroutine_empty_task)
+{
+    co_task<int> empty;
+    CHECK_TRUE(empty.done());
+    CHECK_THROW(sync_wait(std::move(empty)));
+    // also from inside a coroutine
+    CHECK_THROW(sync_wait([]() -> co_task<void> { co_await co_task<void>{}; }()));
+    CHECK_THROW(sync_wait(concat(co_task<int>{}, co_task<int>{})));
+}
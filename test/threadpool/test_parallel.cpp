@@ -0,0 +1,90 @@
+﻿#include "../test.hpp"
+#include "ouchilib/thread/thread-pool.hpp"
+#include "ouchilib/thread/parallel.hpp"
+#include <vector>
+#include <numeric>
+#include <atomic>
+#include <stdexcept>
+
+using namespace ouchi::thread;
+
+DEFINE_TEST(test_parallel_for)
+{
+    thread_pool tp(3);
+    std::vector<int> v(1000);
+    parallel_for(tp, size_t{ 0 }, v.size(), [&v](size_t i) { v[i] = (int)i; });
+    bool ok = true;
+    for (auto i = 0u; i < v.size(); ++i) ok &= v[i] == (int)i;
+    CHECK_TRUE(ok);
+
+    // iterator range and explicit grain
+    std::atomic_int chunks = 0;
+    parallel_for_chunk(tp, v.begin(), v.end(), [&chunks](auto b, auto e) {
+        ++chunks;
+        for (; b != e; ++b) *b *= 2;
+    }, 100);
+    CHECK_EQUAL(chunks, 10);
+    CHECK_EQUAL(v[999], 1998);
+
+    // empty range
+    parallel_for(tp, 0, 0, [](int) { throw 0; });
+}
+
+DEFINE_TEST(test_parallel_reduce)
+{
+    thread_pool tp(4);
+    std::vector<long long> v(12345);
+    std::iota(v.begin(), v.end(), 1);
+    auto sum = parallel_reduce(tp, v.cbegin(), v.cend(), 0ll,
+                               [](long long acc, auto it) { return acc + *it; },
+                               [](long long a, long long b) { return a + b; }, 7);
+    CHECK_EQUAL(sum, 12345ll * 12346 / 2);
+}
+
+DEFINE_TEST(test_parallel_for_exception)
+{
+    thread_pool tp(2);
+    std::atomic_int cnt = 0;
+    CHECK_SPECIFIC_EXCEPTION(parallel_for(tp, 0, 100, [&cnt](int i) {
+        ++cnt;
+        if (i == 10) throw std::runtime_error("10");
+    }, 1), std::runtime_error);
+    CHECK_TRUE(cnt < 100);
+    // the helpers left find nothing to do
+    tp.wait();
+    CHECK_EQUAL(tp.remaining(), 0);
+}
+
+// a paused pool starts no helper, and the calling thread processes every chunk
+DEFINE_TEST(test_parallel_for_paused)
+{
+    thread_pool tp(2);
+    tp.pause();
+    std::vector<int> v(100);
+    parallel_for(tp, size_t{ 0 }, v.size(), [&v](size_t i) { v[i] = 1; }, 1);
+    CHECK_EQUAL(std::accumulate(v.begin(), v.end(), 0), 100);
+    auto sum = parallel_reduce(tp, 0, 100, 0, [](int acc, int i) { return acc + i; },
+                               [](int a, int b) { return a + b; }, 1);
+    CHECK_EQUAL(sum, 4950);
+    tp.resume();
+    tp.wait();
+}
+
+// inner loops run on the workers of the same pool. they are processed inline instead of waiting for queued helpers
+DEFINE_TEST(test_parallel_for_nested)
+{
+    thread_pool tp(2);
+    std::atomic_size_t sum = 0;
+    parallel_for(tp, 0, 16, [&](int i) {
+        parallel_for(tp, 0, 100, [&](int j) { sum += i * 100 + j; }, 1);
+    }, 1);
+    CHECK_EQUAL(sum.load(), 1600 * 1599 / 2);
+
+    // from work pushed to the pool, where the calling thread is not part of the loop
+    std::atomic_size_t count = 0;
+    for (int k = 0; k < 4; ++k) {
+        tp.push([&]() { parallel_for(tp, 0, 50, [&](int) { ++count; }, 1); });
+    }
+    tp.wait();
+    CHECK_EQUAL(count.load(), 200);
+}
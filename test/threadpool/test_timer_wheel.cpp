@@ -0,0 +1,145 @@
+﻿#include "../test.hpp"
+#include "ouchilib/thread/timer_wheel.hpp"
+#include "ouchilib/thread/timer_service.hpp"
+#include <vector>
+#include <atomic>
+#include <random>
+#include <algorithm>
+
+using namespace ouchi::thread;
+
+DEFINE_TEST(test_timer_wheel)
+{
+    using namespace std::chrono_literals;
+    using clock = timer_wheel<int>::clock;
+    auto origin = clock::now();
+    timer_wheel<int> w(1ms, 8, origin);
+    std::vector<int> fired;
+    auto collect = [&fired](int v) { fired.push_back(v); };
+
+    w.schedule(origin + 3ms, 3);
+    w.schedule(origin + 1ms, 1);
+    auto cancelled = w.schedule(origin + 2ms, 2);
+    w.schedule(origin + 20ms, 20);  // on the second level of 8 slots
+    CHECK_EQUAL(w.size(), 4);
+    CHECK_TRUE(w.cancel(cancelled));
+    CHECK_TRUE(!w.cancel(cancelled));
+    CHECK_TRUE(*w.next_expiry() == origin + 2ms);
+
+    CHECK_EQUAL(w.advance(origin + 1ms, collect), 0);  // never early
+    CHECK_EQUAL(w.advance(origin + 4ms, collect), 2);
+    CHECK_TRUE((fired == std::vector<int>{ 1, 3 }));
+    CHECK_TRUE(*w.next_expiry() == origin + 21ms);
+    // 20 moves down to the first level before it is due
+    CHECK_EQUAL(w.advance(origin + 13ms, collect), 0);
+
+    // a timer scheduled in the past fires on the next tick
+    w.schedule(origin, 0);
+    CHECK_EQUAL(w.advance(origin + 14ms, collect), 1);
+    CHECK_EQUAL(fired.back(), 0);
+
+    // several blocks at once keep expiry order
+    w.schedule(origin + 30ms, 30);
+    w.schedule(origin + 25ms, 25);
+    CHECK_EQUAL(w.advance(origin + 100ms, collect), 3);
+    CHECK_TRUE((fired == std::vector<int>{ 1, 3, 0, 20, 25, 30 }));
+    CHECK_TRUE(w.empty() && !w.next_expiry());
+
+    w.schedule(origin + 1s, 1000);
+    w.schedule(origin + 500ms, 500);
+    CHECK_EQUAL(w.expire_all(collect), 2);
+    CHECK_EQUAL(fired.back(), 1000);
+}
+
+DEFINE_TEST(test_timer_wheel_block_boundary)
+{
+    using namespace std::chrono_literals;
+    using clock = timer_wheel<int>::clock;
+    auto origin = clock::now();
+    timer_wheel<int> w(1ms, 4, origin);
+    std::vector<int> fired;
+    auto collect = [&fired](int v) { fired.push_back(v); };
+
+    w.schedule(origin + 5ms, 5);  // in the second block
+    // stops exactly where the second block begins
+    CHECK_EQUAL(w.advance(origin + 4ms, collect), 0);
+    w.schedule(origin + 7ms, 7);
+    CHECK_TRUE(*w.next_expiry() == origin + 6ms);
+    CHECK_EQUAL(w.advance(origin + 6ms, collect), 1);
+    CHECK_TRUE(*w.next_expiry() == origin + 8ms);
+    CHECK_EQUAL(w.advance(origin + 8ms, collect), 1);
+    CHECK_TRUE((fired == std::vector<int>{ 5, 7 }));
+}
+
+DEFINE_TEST(test_timer_wheel_levels)
+{
+    using namespace std::chrono_literals;
+    using clock = timer_wheel<long long>::clock;
+    auto origin = clock::now();
+    // 4 levels of 4 slots cover 256 ticks
+    timer_wheel<long long> w(1ms, 4, origin);
+    std::mt19937 rng(1);
+    std::vector<long long> expected;
+    std::vector<timer_wheel<long long>::timer_id> ids;
+    for (int i = 0; i < 1000; ++i) {
+        long long ms = rng() % 1000;  // also beyond the range of the top level
+        ids.push_back(w.schedule(origin + std::chrono::milliseconds(ms), ms));
+        expected.push_back(ms);
+    }
+    // cancel every third timer
+    std::vector<long long> kept;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        if (i % 3 == 0) CHECK_TRUE(w.cancel(ids[i]));
+        else kept.push_back(expected[i]);
+    }
+    std::sort(kept.begin(), kept.end());
+    CHECK_EQUAL(w.size(), kept.size());
+
+    std::vector<long long> fired;
+    bool early = false;
+    for (auto now = origin; !w.empty(); now += 7ms) {
+        if (auto next = w.next_expiry()) CHECK_TRUE(*next > now);
+        w.advance(now + 7ms, [&](long long ms) {
+            early |= origin + std::chrono::milliseconds(ms) >= now + 7ms;
+            fired.push_back(ms);
+        });
+    }
+    CHECK_TRUE(!early);
+    CHECK_TRUE(fired == kept);  // in expiry order
+}
+
+DEFINE_TEST(test_timer_service)
+{
+    using namespace std::chrono_literals;
+    thread_pool pool(2);
+    std::atomic_int once = 0, periodic = 0, cancelled = 0, many = 0;
+    {
+        timer_service timers(pool);
+        timers.schedule_after(5ms, [&once]() { ++once; });
+        auto c = timers.schedule_after(200ms, [&cancelled]() { ++cancelled; });
+        ouchi::time_keeper<> keeper(10ms);
+        auto p = timers.schedule_every(keeper, [&periodic]() { ++periodic; });
+        // a thousand timers on the single timer thread
+        for (int i = 0; i < 1000; ++i)
+            timers.schedule_after(std::chrono::milliseconds(i % 50), [&many]() { ++many; });
+        CHECK_TRUE(timers.cancel(c));
+        CHECK_TRUE(!timers.cancel(c));
+
+        std::this_thread::sleep_for(120ms);
+        CHECK_TRUE(timers.cancel(p));
+        CHECK_TRUE(!timers.is_pending(p));
+        pool.wait();
+        auto runs = periodic.load();
+        std::this_thread::sleep_for(30ms);
+        CHECK_EQUAL(periodic.load(), runs);
+        CHECK_TRUE(runs >= 3);
+        CHECK_EQUAL(timers.size(), 0);
+
+        // pending timers are discarded with the service
+        timers.schedule_after(1h, [&cancelled]() { ++cancelled; });
+    }
+    pool.wait();
+    CHECK_EQUAL(once.load(), 1);
+    CHECK_EQUAL(many.load(), 1000);
+    CHECK_EQUAL(cancelled.load(), 0);
+}